@@ -29,16 +29,20 @@
 
 // SerialEvent functions are weak, so when the user doesn't define them,
 // the linker just sets their address to 0 (which is checked below).
-// The Serialx_available is just a wrapper around Serialx.available(),
+// The Serialx_available is just a wrapper around Serialx.eventPending(),
 // but we can refer to it weakly so we don't pull in the entire
 // HardwareSerial instance if the user doesn't also refer to it.
 
+#define SERIALNUMS 5
+
+static HardwareSerial *hardwareserialObj[SERIALNUMS] = {NULL};
+
 #if defined(HAVE_HWSERIAL1)
 HardwareSerial Serial1(RX0, TX0, 0);
 void serialEvent1() __attribute__((weak));
 bool Serial1_available()
 {
-    return Serial1.available() > 0;
+    return Serial1.eventPending();
 }
 #endif
 
@@ -47,7 +51,7 @@ HardwareSerial Serial2(RX1, TX1, 1);
 void serialEvent2() __attribute__((weak));
 bool Serial2_available()
 {
-    return Serial2.available() > 0;
+    return Serial2.eventPending();
 }
 #endif
 
@@ -56,7 +60,7 @@ HardwareSerial Serial3(RX2, TX2, 2);
 void serialEvent3() __attribute__((weak));
 bool Serial3_available()
 {
-    return Serial3.available() > 0;
+    return Serial3.eventPending();
 }
 #endif
 
@@ -65,7 +69,7 @@ HardwareSerial Serial4(RX3, TX3, 3);
 void serialEvent4() __attribute__((weak));
 bool Serial4_available()
 {
-    return Serial4.available() > 0;
+    return Serial4.eventPending();
 }
 #endif
 
@@ -74,7 +78,7 @@ HardwareSerial Serial5(RX4, TX4, 4);
 void serialEvent5() __attribute__((weak));
 bool Serial5_available()
 {
-    return Serial5.available() > 0;
+    return Serial5.eventPending();
 }
 #endif
 
@@ -107,23 +111,34 @@ void serialEventRun(void)
     }
 #endif
 }
-ring_buffer_r HardwareSerial::_rx_buffer = {{0}, 0, 0};
-ring_buffer_t HardwareSerial::_tx_buffer = {{0}, 0, 0};
 
 
 HardwareSerial::HardwareSerial(uint8_t rx, uint8_t tx, int uart_index)
 {
     _serial.pin_rx = DIGITAL_TO_PINNAME(rx);
     _serial.pin_tx =  DIGITAL_TO_PINNAME(tx);
-    _serial.rx_buffer_ptr = _rx_buffer.buffer;
-    _serial.tx_buffer_ptr = _tx_buffer.buffer;
-    _rx_buffer.head = 0;
-    _rx_buffer.tail = 0;
-    _tx_buffer.head = 0;
-    _tx_buffer.tail = 0;
+    _serial.pin_rts = NC;
+    _serial.pin_cts = NC;
+    _serial.pin_de = NC;
+    _serial.half_duplex = 0;
+    _serial.de_active_high = 1;
+    _serial.de_assert_us = 0;
+    _serial.de_deassert_us = 0;
+    _serial.line_driven = 0;
+    _serial.tx_dma = 0;
+    _serial.rx_buffer_ptr = &_rx_byte;
+    _serial.tx_buffer_ptr = NULL;
     _serial.tx_count = 0;
+    _tx_inflight = 0;
+    _rx_paused = false;
     _serial.index = uart_index;
-
+    _event_mode = false;
+    _event_delimiter = SERIAL_EVENT_ANY_BYTE;
+    _event_count = 0;
+    _event_handled = 0;
+    if (uart_index < SERIALNUMS) {
+        hardwareserialObj[uart_index] = this;
+    }
 }
 
 void HardwareSerial::begin(unsigned long baud, uint8_t config)
@@ -164,15 +179,39 @@ void HardwareSerial::begin(unsigned long baud, uint8_t config)
     serial_baud(&_serial, baud);
     serial_format(&_serial, databits, parity, stopbits);
 
+    if (_serial.pin_rts != NC || _serial.pin_cts != NC) {
+        FlowControl flow = FlowControlRTSCTS;
+        if (_serial.pin_cts == NC) {
+            flow = FlowControlRTS;
+        } else if (_serial.pin_rts == NC) {
+            flow = FlowControlCTS;
+        }
+        serial_set_flow_control(&_serial, flow, _serial.pin_rts, _serial.pin_cts);
+    }
+
+    if (_serial.half_duplex) {
+        serial_set_half_duplex(&_serial, 1);
+    }
+    if (_serial.pin_de != NC) {
+        serial_set_driver_enable(&_serial, _serial.pin_de, _serial.de_active_high,
+                                 _serial.de_assert_us, _serial.de_deassert_us);
+    }
+    if (_serial.half_duplex || _serial.pin_de != NC) {
+        serial_tx_dma_enable(&_serial, 1);
+    }
+
+    _rx_paused = false;
+    memset(&_serial.stats, 0, sizeof(_serial.stats));
     uart_attach_rx_callback(&_serial, _rx_complete_irq);
-    serial_receive(&_serial, &_rx_buffer.buffer[_rx_buffer.head], 1);
+    uart_attach_tx_callback(&_serial, _tx_complete_irq);
+    serial_receive(&_serial, &_rx_byte, 1);
 
 }
 
 void HardwareSerial::end()
 {
     //clear any received data
-    _rx_buffer.head = _rx_buffer.tail;
+    _rx_buffer.clear();
     //wait for any outstanding data to be sent
     flush();
     //disable the USART
@@ -181,41 +220,39 @@ void HardwareSerial::end()
 
 int HardwareSerial::available(void)
 {
-    return ((unsigned int)(SERIAL_RX_BUFFER_SIZE + _rx_buffer.head - _rx_buffer.tail)) %
-           SERIAL_RX_BUFFER_SIZE;
+    return _rx_buffer.available();
 }
+
 int HardwareSerial::peek(void)
 {
-    if (_rx_buffer.head == _rx_buffer.tail) {
+    uint8_t c;
+
+    if (!_rx_buffer.peek(c)) {
         return -1;
-    } else {
-        return _rx_buffer.buffer[_rx_buffer.tail];
     }
+    return c;
 }
 
 int HardwareSerial::read(void)
 {
-    unsigned char c;
+    uint8_t c;
 
     // if the head isn't ahead of the tail, we don't have any characters
-    if (_rx_buffer.head == _rx_buffer.tail) {
+    if (!_rx_buffer.pop(c)) {
         return -1;
-    } else {
-        c = _rx_buffer.buffer[_rx_buffer.tail];
-        _rx_buffer.tail = (rx_buffer_index_t)(_rx_buffer.tail + 1) % SERIAL_RX_BUFFER_SIZE;
-        return c;
     }
+    // There is room again: collect the byte held in the USART, which
+    // reasserts RTS. The RX interrupt is disarmed, so it can't race us.
+    if (_rx_paused) {
+        _rx_paused = false;
+        serial_receive(&_serial, &_rx_byte, 1);
+    }
+    return c;
 }
 
 int HardwareSerial::availableForWrite(void)
 {
-    tx_buffer_index_t head = _tx_buffer.head;
-    tx_buffer_index_t tail = _tx_buffer.tail;
-
-    if (head >= tail) {
-        return SERIAL_TX_BUFFER_SIZE - 1 - head + tail;
-    }
-    return tail - head - 1;
+    return _tx_buffer.availableForWrite();
 }
 
 void HardwareSerial::flush()
@@ -227,49 +264,189 @@ void HardwareSerial::flush()
         return;
     }
     //wait for transmit data to be sent
-    while ((_tx_buffer.head != _tx_buffer.tail)) {
+    while (!_tx_buffer.isEmpty()) {
         // wait for transmit data to be sent
     }
     // Wait for transmission to complete
-    while ((_serial.tx_state & OP_STATE_BUSY) != 0);
+    while (serial_tx_active(&_serial)) {
+    }
+}
+
+/*!
+    \brief      enable or disable ISR-triggered serial events
+    \param[in]  enable: true to let the RX interrupt flag pending events
+    \param[in]  delimiter: byte that raises an event, or SERIAL_EVENT_ANY_BYTE
+    \param[out] none
+    \retval     none
+*/
+void HardwareSerial::setEventMode(bool enable, int delimiter)
+{
+    _event_delimiter = delimiter;
+    _event_handled = _event_count;
+    _event_mode = enable;
+}
+
+/*!
+    \brief      select the RTS/CTS pins used by the next begin()
+    \param[in]  rts: RTS pin, or SERIAL_FLOW_PIN_NONE
+    \param[in]  cts: CTS pin, or SERIAL_FLOW_PIN_NONE
+    \param[out] none
+    \retval     none
+*/
+void HardwareSerial::setFlowControl(uint8_t rts, uint8_t cts)
+{
+    _serial.pin_rts = DIGITAL_TO_PINNAME(rts);
+    _serial.pin_cts = DIGITAL_TO_PINNAME(cts);
+}
+
+/*!
+    \brief      select single-wire half-duplex mode for the next begin()
+    \param[in]  enable: true to share the TX pin between transmit and receive
+    \param[out] none
+    \retval     none
+*/
+void HardwareSerial::setHalfDuplex(bool enable)
+{
+    _serial.half_duplex = enable ? 1 : 0;
+}
+
+/*!
+    \brief      select the RS-485 driver enable pin and timing for the next begin()
+    \param[in]  de: DE pin, or SERIAL_FLOW_PIN_NONE to disable
+    \param[in]  active_high: true if the transceiver drives the bus while DE is high
+    \param[in]  assert_us: delay from asserting DE to the first start bit
+    \param[in]  deassert_us: delay from the last stop bit to releasing DE
+    \param[out] none
+    \retval     none
+*/
+void HardwareSerial::setDriverEnable(uint8_t de, bool active_high, uint16_t assert_us,
+                                     uint16_t deassert_us)
+{
+    _serial.pin_de = DIGITAL_TO_PINNAME(de);
+    _serial.de_active_high = active_high ? 1 : 0;
+    _serial.de_assert_us = assert_us;
+    _serial.de_deassert_us = deassert_us;
+}
+
+/*!
+    \brief      read the port's counters
+    \param[in]  reset: true to zero the counters after reading them
+    \param[out] none
+    \retval     a snapshot of the counters
+*/
+serial_stats_t HardwareSerial::stats(bool reset)
+{
+    serial_stats_t snapshot;
+    serial_get_stats(&_serial, &snapshot, reset);
+    return snapshot;
+}
+
+/*!
+    \brief      check for, and consume, a pending serial event
+    \param[in]  none
+    \param[out] none
+    \retval     true if serialEventN() should run
+*/
+bool HardwareSerial::eventPending(void)
+{
+    if (!_event_mode) {
+        return available() > 0;
+    }
+    uint8_t count = _event_count;
+    if (count == _event_handled) {
+        return false;
+    }
+    if (_event_delimiter == SERIAL_EVENT_ANY_BYTE) {
+        // one call drains everything received so far
+        _event_handled = count;
+    } else {
+        // one call per delimiter, so no line is left behind
+        _event_handled++;
+    }
+    return true;
 }
 
 size_t HardwareSerial::write(uint8_t c)
 {
     _written = true;
-    tx_buffer_index_t nextWrite = (_tx_buffer.head + 1) % SERIAL_TX_BUFFER_SIZE;
-    while (_tx_buffer.tail == nextWrite) {
+    while (!_tx_buffer.push(c)) {
     }   // Spin locks if we're about to overwrite the buffer. This continues once the data is sent
-    _tx_buffer.buffer[_tx_buffer.head] = c;
-    _tx_buffer.head = nextWrite;
+    startTransmit();
+    return 1;
+}
 
-    _serial.tx_count++;
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+    size_t sent = 0;
 
-    if (!serial_tx_active(&_serial)) {
-        uart_attach_tx_callback(&_serial, _tx_complete_irq);
-        serial_transmit(&_serial, &_tx_buffer.buffer[_tx_buffer.tail], 1);
+    _written = true;
+    while (sent < size) {
+        size_t n = _tx_buffer.write(buffer + sent, size - sent);
+        if (n) {
+            sent += n;
+            startTransmit();
+        }
+    }
+    return size;
+}
 
+/*!
+    \brief      hand the oldest contiguous run of queued bytes to the UART
+    \param[in]  none
+    \param[out] none
+    \retval     none
+*/
+void HardwareSerial::startTransmit(void)
+{
+    // The TX complete interrupt also starts transfers, so only kick the
+    // UART from thread context with interrupts masked
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!_tx_inflight && !serial_tx_active(&_serial)) {
+        uint8_t *span;
+        size_t n = _tx_buffer.popSpan(&span);
+        if (n) {
+            _tx_inflight = n;
+            serial_transmit(&_serial, span, n);
+        }
     }
-    return 1;
+    __set_PRIMASK(primask);
 }
 
 void HardwareSerial::_rx_complete_irq(serial_t *obj)
 {
-    // No Parity error, read byte and store it in the buffer if there is room
-    unsigned char c;
     if (obj == NULL) {
         return;
     }
     if (serial_rx_active(obj)) {
         return;
     }
-    c = serial_getc(obj);
-    rx_buffer_index_t i = (unsigned int)(_rx_buffer.head + 1) % SERIAL_RX_BUFFER_SIZE;
-    if (i != _rx_buffer.tail) {
-        _rx_buffer.buffer[_rx_buffer.head] = c;
-        _rx_buffer.head = i;
+    HardwareSerial *serial = hardwareserialObj[obj->index];
+    if (serial == NULL) {
+        return;
+    }
+    // No Parity error, store the byte in the buffer if there is room
+    uint8_t c = serial->_rx_byte;
+    obj->stats.rx_bytes++;
+    if (!serial->_rx_buffer.push(c)) {
+        obj->stats.rx_dropped++;
+    }
+    uint32_t occupancy = serial->_rx_buffer.available();
+    if (occupancy > obj->stats.rx_peak) {
+        obj->stats.rx_peak = occupancy;
+    }
+    if (serial->_event_mode &&
+        (serial->_event_delimiter == SERIAL_EVENT_ANY_BYTE || serial->_event_delimiter == c)) {
+        serial->_event_count++;
+    }
+    // With RTS flow control, stop draining the USART once the buffer is
+    // full; the next byte then stays in the data register and the USART
+    // holds RTS deasserted until read() re-arms reception.
+    if (obj->pin_rts != NC && serial->_rx_buffer.isFull()) {
+        serial->_rx_paused = true;
+        return;
     }
-    serial_receive(obj, &_rx_buffer.buffer[_rx_buffer.head], 1);
+    serial_receive(obj, &serial->_rx_byte, 1);
 }
 
 void HardwareSerial::_tx_complete_irq(serial_t *obj)
@@ -277,41 +454,17 @@ void HardwareSerial::_tx_complete_irq(serial_t *obj)
     if (obj == NULL) {
         return;
     }
-    _tx_buffer.tail = (_tx_buffer.tail + 1) % SERIAL_TX_BUFFER_SIZE;
-    if (_tx_buffer.head == _tx_buffer.tail) {
-    } else {
-        serial_transmit(obj, &_tx_buffer.buffer[_tx_buffer.tail], 1);
+    HardwareSerial *serial = hardwareserialObj[obj->index];
+    if (serial == NULL) {
+        return;
+    }
+    // release the span that just went out and send the next one, if any
+    obj->stats.tx_bytes += serial->_tx_inflight;
+    serial->_tx_buffer.commitPop(serial->_tx_inflight);
+    uint8_t *span;
+    size_t n = serial->_tx_buffer.popSpan(&span);
+    serial->_tx_inflight = n;
+    if (n) {
+        serial_transmit(obj, span, n);
     }
 }
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
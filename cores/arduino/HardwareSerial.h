@@ -28,19 +28,15 @@
 
 #include "api/Stream.h"
 #include "uart.h"
+#include "SPSCRingBuffer.h"
 
 
-// Define constants and variables for buffering incoming serial data.  We're
-// using a ring buffer (I think), in which head is the index of the location
-// to which to write the next incoming character and tail is the index of the
-// location from which to read.
-// NOTE: a "power of 2" buffer size is reccomended to dramatically
-//       optimize all the modulo operations for ring buffers.
-// WARNING: When buffer sizes are increased to > 256, the buffer index
-// variables are automatically increased in size, but the extra
-// atomicity guards needed for that are not implemented. This will
-// often work, but occasionally a race condition can occur that makes
-// Serial behave erratically. See https://github.com/arduino/Arduino/issues/2405
+// Define constants and variables for buffering incoming serial data. Each
+// port owns a lock-free single-producer/single-consumer ring for each
+// direction (see SPSCRingBuffer.h): the UART interrupt is the only producer
+// of the RX ring and the only consumer of the TX ring, so no interrupt
+// masking is needed around the hot paths, at any buffer size.
+// NOTE: buffer sizes are rounded down to a power of 2.
 
 #if !defined(SERIAL_TX_BUFFER_SIZE)
 #define SERIAL_TX_BUFFER_SIZE 64
@@ -48,29 +44,6 @@
 #if !defined(SERIAL_RX_BUFFER_SIZE)
 #define SERIAL_RX_BUFFER_SIZE 64
 #endif
-#if (SERIAL_TX_BUFFER_SIZE>256)
-typedef uint16_t tx_buffer_index_t;
-#else
-typedef uint8_t tx_buffer_index_t;
-#endif
-#if  (SERIAL_RX_BUFFER_SIZE>256)
-typedef uint16_t rx_buffer_index_t;
-#else
-typedef uint8_t rx_buffer_index_t;
-#endif
-
-
-typedef struct {
-    unsigned char buffer[SERIAL_RX_BUFFER_SIZE];
-    volatile int head;
-    volatile int tail;
-} ring_buffer_r;
-
-typedef struct {
-    unsigned char buffer[SERIAL_TX_BUFFER_SIZE];
-    volatile int head;
-    volatile int tail;
-} ring_buffer_t;
 
 #define SERIAL_8N1 0x06
 #define SERIAL_8N2 0x0E
@@ -83,6 +56,12 @@ typedef struct {
 #define SERIAL_7O2 0x3C
 #define SERIAL_8O2 0x3E
 
+/* Pass as the delimiter to setEventMode() to raise an event for every byte */
+#define SERIAL_EVENT_ANY_BYTE (-1)
+
+/* Pass to setFlowControl() for a handshake line that isn't wired */
+#define SERIAL_FLOW_PIN_NONE 0xFF
+
 class HardwareSerial : public Stream
 {
     protected:
@@ -90,6 +69,11 @@ class HardwareSerial : public Stream
         volatile bool _written;
         serial_t _serial;
 
+        bool _event_mode;
+        int _event_delimiter;
+        volatile uint8_t _event_count;
+        uint8_t _event_handled;
+
     public:
         HardwareSerial(uint8_t rx, uint8_t tx, int uart_index);
         void begin(unsigned long baud)
@@ -104,6 +88,7 @@ class HardwareSerial : public Stream
         int availableForWrite(void);
         virtual void flush(void);
         virtual size_t write(uint8_t);
+        virtual size_t write(const uint8_t *buffer, size_t size);
         inline size_t write(unsigned long n)
         {
             return write((uint8_t)n);
@@ -126,13 +111,46 @@ class HardwareSerial : public Stream
             return true;
         }
 
+        // Event mode: serialEventRun() only calls serialEventN() once the RX
+        // interrupt has flagged new data (or a delimiter byte), instead of
+        // checking available() on every pass through loop().
+        void setEventMode(bool enable, int delimiter = SERIAL_EVENT_ANY_BYTE);
+        bool eventPending(void);
+
+        // Hardware RTS/CTS flow control, applied by the next begin(). While
+        // the RX buffer is full the last byte is left in the USART, which
+        // makes it deassert RTS until read() frees up room.
+        void setFlowControl(uint8_t rts, uint8_t cts);
+
+        // Single-wire half-duplex on the TX pin, and RS-485 driver enable
+        // timing, applied by the next begin(). In these modes data goes out
+        // by DMA when the USART's channel is free, and the line is turned
+        // around from the transmit complete interrupt. Without a hardware
+        // DE output the DE delays are busy-waited, in that interrupt for the
+        // deassert one, and capped at SERIAL_DE_DELAY_MAX_US.
+        void setHalfDuplex(bool enable);
+        void setDriverEnable(uint8_t de, bool active_high = true, uint16_t assert_us = 0,
+                             uint16_t deassert_us = 0);
+
+        // Byte, drop and line error counters since begin() or the last
+        // stats(true)
+        serial_stats_t stats(bool reset = false);
+
         // Interrupt handlers
         static void _rx_complete_irq(serial_t *obj);
         static void _tx_complete_irq(serial_t *obj);
 
     private:
-        static ring_buffer_r _rx_buffer;
-        static ring_buffer_t _tx_buffer;
+        SPSCRingBufferN<uint8_t, SERIAL_RX_BUFFER_SIZE> _rx_buffer;
+        SPSCRingBufferN<uint8_t, SERIAL_TX_BUFFER_SIZE> _tx_buffer;
+        // Byte the RX interrupt receives into before pushing it to _rx_buffer
+        uint8_t _rx_byte;
+        // Length of the _tx_buffer span currently handed to serial_transmit()
+        volatile size_t _tx_inflight;
+        // RX interrupt left disarmed because _rx_buffer was full (RTS only)
+        volatile bool _rx_paused;
+
+        void startTransmit(void);
 };
 
 /*
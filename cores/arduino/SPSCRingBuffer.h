@@ -0,0 +1,250 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "gd32xxyy.h"
+
+/*
+ * Lock-free single-producer/single-consumer ring buffer.
+ *
+ * One context (typically an interrupt handler) only calls the producer
+ * methods and one other context only calls the consumer methods, so
+ * neither side ever needs to mask interrupts. The head and tail indices
+ * are free-running 32-bit counters: only the producer writes _head, only
+ * the consumer writes _tail, and the fill level is simply their
+ * difference. The capacity is a power of two, so wrapping an index into
+ * the storage is a mask instead of a modulo; other sizes are rounded down.
+ *
+ * The span methods expose the contiguous free (producer) or filled
+ * (consumer) region starting at the current index, so a driver can hand
+ * the memory straight to the peripheral (a multi-byte serial_transmit(),
+ * an I2C transfer, DMA, ...) and commit the whole block at once.
+ */
+template <typename T>
+class SPSCRingBuffer
+{
+    public:
+        SPSCRingBuffer(void) : _buffer(NULL), _size(0), _mask(0), _head(0), _tail(0) {}
+        SPSCRingBuffer(T *buffer, size_t size)
+        {
+            attach(buffer, size);
+        }
+
+        /*
+         * Use caller-provided storage. A size that isn't a power of two is
+         * rounded down to one, as in SPSCRingBufferN; capacity() tells the
+         * size used. Neither side may be active.
+         */
+        void attach(T *buffer, size_t size)
+        {
+            while (size & (size - 1)) {
+                size &= size - 1;
+            }
+            _buffer = buffer;
+            _size = buffer ? size : 0;
+            _mask = _size ? _size - 1 : 0;
+            _head = 0;
+            _tail = 0;
+        }
+
+        size_t capacity(void) const
+        {
+            return _size;
+        }
+
+        /* Number of elements queued. Safe to call from either side. */
+        size_t available(void) const
+        {
+            return (uint32_t)(_head - _tail);
+        }
+
+        /* Number of free slots. Safe to call from either side. */
+        size_t availableForWrite(void) const
+        {
+            return _size - available();
+        }
+
+        bool isEmpty(void) const
+        {
+            return _head == _tail;
+        }
+
+        bool isFull(void) const
+        {
+            return available() >= _size;
+        }
+
+        /* Drop all queued elements, only valid while neither side is active. */
+        void reset(void)
+        {
+            _head = 0;
+            _tail = 0;
+        }
+
+        /*
+         * Producer side
+         */
+
+        bool push(T value)
+        {
+            uint32_t head = _head;
+            if ((uint32_t)(head - _tail) >= _size) {
+                return false;
+            }
+            _buffer[head & _mask] = value;
+            /* the element must be visible before the index that publishes it */
+            __DMB();
+            _head = head + 1;
+            return true;
+        }
+
+        /* Contiguous free region starting at the head; returns its length. */
+        size_t pushSpan(T **span)
+        {
+            uint32_t head = _head;
+            uint32_t free = _size - (uint32_t)(head - _tail);
+            uint32_t index = head & _mask;
+            uint32_t contiguous = _size - index;
+            *span = &_buffer[index];
+            return (free < contiguous) ? free : contiguous;
+        }
+
+        /* Publish n elements written through pushSpan(). */
+        void commitPush(size_t n)
+        {
+            __DMB();
+            _head = _head + (uint32_t)n;
+        }
+
+        /* Queue up to n elements; returns how many fit. */
+        size_t write(const T *data, size_t n)
+        {
+            size_t done = 0;
+            while (done < n) {
+                T *span;
+                size_t len = pushSpan(&span);
+                if (len == 0) {
+                    break;
+                }
+                if (len > n - done) {
+                    len = n - done;
+                }
+                memcpy(span, data + done, len * sizeof(T));
+                commitPush(len);
+                done += len;
+            }
+            return done;
+        }
+
+        /*
+         * Consumer side
+         */
+
+        bool pop(T &value)
+        {
+            uint32_t tail = _tail;
+            if (_head == tail) {
+                return false;
+            }
+            /* don't read the element before seeing the index that published it */
+            __DMB();
+            value = _buffer[tail & _mask];
+            /* finish reading before handing the slot back to the producer */
+            __DMB();
+            _tail = tail + 1;
+            return true;
+        }
+
+        bool peek(T &value) const
+        {
+            uint32_t tail = _tail;
+            if (_head == tail) {
+                return false;
+            }
+            __DMB();
+            value = _buffer[tail & _mask];
+            return true;
+        }
+
+        /* Contiguous filled region starting at the tail; returns its length. */
+        size_t popSpan(T **span)
+        {
+            uint32_t tail = _tail;
+            uint32_t used = (uint32_t)(_head - tail);
+            uint32_t index = tail & _mask;
+            uint32_t contiguous = _size - index;
+            __DMB();
+            *span = &_buffer[index];
+            return (used < contiguous) ? used : contiguous;
+        }
+
+        /* Release n elements read through popSpan(). */
+        void commitPop(size_t n)
+        {
+            __DMB();
+            _tail = _tail + (uint32_t)n;
+        }
+
+        /* Dequeue up to n elements; returns how many were read. */
+        size_t read(T *data, size_t n)
+        {
+            size_t done = 0;
+            while (done < n) {
+                T *span;
+                size_t len = popSpan(&span);
+                if (len == 0) {
+                    break;
+                }
+                if (len > n - done) {
+                    len = n - done;
+                }
+                memcpy(data + done, span, len * sizeof(T));
+                commitPop(len);
+                done += len;
+            }
+            return done;
+        }
+
+        /* Drop everything queued so far. Consumer side only. */
+        void clear(void)
+        {
+            _tail = _head;
+        }
+
+    private:
+        T *_buffer;
+        uint32_t _size;
+        uint32_t _mask;
+        volatile uint32_t _head;
+        volatile uint32_t _tail;
+};
+
+/*
+ * Ring buffer with its own storage of N elements. Like attach(), a size
+ * that isn't a power of two is rounded down to one, so configured buffer
+ * sizes such as SERIAL_RX_BUFFER_SIZE keep building; capacity() tells the
+ * size actually used.
+ */
+template <typename T, size_t N>
+class SPSCRingBufferN : public SPSCRingBuffer<T>
+{
+        static_assert(N != 0, "SPSCRingBufferN size must not be zero");
+
+        static constexpr size_t roundDown(size_t n)
+        {
+            return (n & (n - 1)) ? roundDown(n & (n - 1)) : n;
+        }
+        static constexpr size_t Size = roundDown(N);
+
+    public:
+        SPSCRingBufferN(void) : SPSCRingBuffer<T>(_storage, Size) {}
+
+        /* Go back to the built-in storage after attach(). */
+        void detach(void)
+        {
+            SPSCRingBuffer<T>::attach(_storage, Size);
+        }
+
+    private:
+        T _storage[Size];
+};
@@ -0,0 +1,340 @@
+/*
+    Copyright (c) 2020, GigaDevice Semiconductor Inc.
+
+    Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+#include "dma.h"
+
+#if defined(GD32F30x) || defined(GD32E50X)
+
+#define DMA0_CHANNEL_NUMS   (7)
+#define DMA1_CHANNEL_NUMS   (5)
+
+#if defined(GD32F30X_CL) || defined(GD32E50X_CL) || defined(GD32E508)
+#define DMA1_CH3_IRQn       DMA1_Channel3_IRQn
+#define DMA1_CH4_IRQn       DMA1_Channel4_IRQn
+#else
+#define DMA1_CH3_IRQn       DMA1_Channel3_Channel4_IRQn
+#define DMA1_CH4_IRQn       DMA1_Channel3_Channel4_IRQn
+#endif
+
+typedef struct {
+    IRQn_Type irqNum;
+    dma_callback_t callback;
+    void *param;
+} dmaConf_t;
+
+static dmaConf_t dma0_infor[DMA0_CHANNEL_NUMS] = {
+    {DMA0_Channel0_IRQn,  NULL, NULL},
+    {DMA0_Channel1_IRQn,  NULL, NULL},
+    {DMA0_Channel2_IRQn,  NULL, NULL},
+    {DMA0_Channel3_IRQn,  NULL, NULL},
+    {DMA0_Channel4_IRQn,  NULL, NULL},
+    {DMA0_Channel5_IRQn,  NULL, NULL},
+    {DMA0_Channel6_IRQn,  NULL, NULL}
+};
+
+static dmaConf_t dma1_infor[DMA1_CHANNEL_NUMS] = {
+    {DMA1_Channel0_IRQn,  NULL, NULL},
+    {DMA1_Channel1_IRQn,  NULL, NULL},
+    {DMA1_Channel2_IRQn,  NULL, NULL},
+    {DMA1_CH3_IRQn,       NULL, NULL},
+    {DMA1_CH4_IRQn,       NULL, NULL}
+};
+
+static dmaConf_t *dma_get_conf(uint32_t dma_periph, dma_channel_enum channelx)
+{
+    if ((DMA0 == dma_periph) && ((uint32_t)channelx < DMA0_CHANNEL_NUMS)) {
+        return &dma0_infor[channelx];
+    }
+    if ((DMA1 == dma_periph) && ((uint32_t)channelx < DMA1_CHANNEL_NUMS)) {
+        return &dma1_infor[channelx];
+    }
+    return NULL;
+}
+
+/*!
+    \brief      take ownership of a DMA channel
+    \param[in]  dma_periph: DMA0 or DMA1
+    \param[in]  channelx: the channel to claim
+    \param[in]  callback: called from the DMA interrupt with the DMA_EVENT_* that occurred
+    \param[in]  param: passed back to callback
+    \param[out] none
+    \retval     true if the channel is now owned by the caller
+*/
+bool dma_channel_claim(uint32_t dma_periph, dma_channel_enum channelx, dma_callback_t callback,
+                       void *param)
+{
+    dmaConf_t *conf = dma_get_conf(dma_periph, channelx);
+    bool claimed = false;
+
+    if ((NULL == conf) || (NULL == callback)) {
+        return false;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (NULL == conf->callback) {
+        conf->callback = callback;
+        conf->param = param;
+        claimed = true;
+    }
+    __set_PRIMASK(primask);
+
+    if (claimed) {
+        rcu_periph_clock_enable((DMA0 == dma_periph) ? RCU_DMA0 : RCU_DMA1);
+        dma_deinit(dma_periph, channelx);
+        nvic_irq_enable(conf->irqNum, DMA_IRQ_PRIO, DMA_IRQ_SUBPRIO);
+    }
+    return claimed;
+}
+
+/*!
+    \brief      stop a DMA channel and give it back
+    \param[in]  dma_periph: DMA0 or DMA1
+    \param[in]  channelx: the channel to release
+    \param[out] none
+    \retval     none
+*/
+void dma_channel_release(uint32_t dma_periph, dma_channel_enum channelx)
+{
+    dmaConf_t *conf = dma_get_conf(dma_periph, channelx);
+
+    if (NULL == conf) {
+        return;
+    }
+    dma_channel_stop(dma_periph, channelx);
+    conf->callback = NULL;
+    conf->param = NULL;
+
+    /* DMA1 channel 3 and 4 may share an interrupt line */
+    if ((DMA1_CH3_IRQn == DMA1_CH4_IRQn) && (DMA1 == dma_periph) &&
+        ((DMA_CH3 == channelx) || (DMA_CH4 == channelx))) {
+        if ((NULL != dma1_infor[DMA_CH3].callback) || (NULL != dma1_infor[DMA_CH4].callback)) {
+            return;
+        }
+    }
+    nvic_irq_disable(conf->irqNum);
+}
+
+/*!
+    \brief      (re)configure a claimed channel and start it
+    \param[in]  dma_periph: DMA0 or DMA1
+    \param[in]  channelx: a channel claimed with dma_channel_claim()
+    \param[in]  init: addresses, widths, count, priority and direction of the transfer
+    \param[in]  events: DMA_EVENT_* to report to the channel callback
+    \param[in]  circular: restart from the beginning when the count runs out
+    \param[out] none
+    \retval     none
+*/
+void dma_channel_start(uint32_t dma_periph, dma_channel_enum channelx, dma_parameter_struct *init,
+                       uint32_t events, bool circular)
+{
+    dma_channel_disable(dma_periph, channelx);
+    dma_flag_clear(dma_periph, channelx, DMA_FLAG_G);
+    dma_init(dma_periph, channelx, init);
+    if (circular) {
+        dma_circulation_enable(dma_periph, channelx);
+    } else {
+        dma_circulation_disable(dma_periph, channelx);
+    }
+    dma_memory_to_memory_disable(dma_periph, channelx);
+    if (events & DMA_EVENT_FULL_TRANSFER) {
+        dma_interrupt_enable(dma_periph, channelx, DMA_INT_FTF);
+    }
+    if (events & DMA_EVENT_HALF_TRANSFER) {
+        dma_interrupt_enable(dma_periph, channelx, DMA_INT_HTF);
+    }
+    if (events & DMA_EVENT_ERROR) {
+        dma_interrupt_enable(dma_periph, channelx, DMA_INT_ERR);
+    }
+    dma_channel_enable(dma_periph, channelx);
+}
+
+/*!
+    \brief      stop a running channel, without reporting any event
+    \param[in]  dma_periph: DMA0 or DMA1
+    \param[in]  channelx: the channel to stop
+    \param[out] none
+    \retval     none
+*/
+void dma_channel_stop(uint32_t dma_periph, dma_channel_enum channelx)
+{
+    dma_channel_disable(dma_periph, channelx);
+    dma_interrupt_disable(dma_periph, channelx, DMA_INT_FTF | DMA_INT_HTF | DMA_INT_ERR);
+    dma_flag_clear(dma_periph, channelx, DMA_FLAG_G);
+}
+
+/*!
+    \brief      number of transfers the channel still has to do
+    \param[in]  dma_periph: DMA0 or DMA1
+    \param[in]  channelx: the channel to query
+    \param[out] none
+    \retval     remaining transfer count
+*/
+uint32_t dma_channel_remaining(uint32_t dma_periph, dma_channel_enum channelx)
+{
+    return dma_transfer_number_get(dma_periph, channelx);
+}
+
+static void dma_callbackHandler(uint32_t dma_periph, dma_channel_enum channelx)
+{
+    dmaConf_t *conf = dma_get_conf(dma_periph, channelx);
+    uint32_t events = 0;
+
+    if (RESET != dma_interrupt_flag_get(dma_periph, channelx, DMA_INT_FLAG_ERR)) {
+        events |= DMA_EVENT_ERROR;
+    }
+    if (RESET != dma_interrupt_flag_get(dma_periph, channelx, DMA_INT_FLAG_HTF)) {
+        events |= DMA_EVENT_HALF_TRANSFER;
+    }
+    if (RESET != dma_interrupt_flag_get(dma_periph, channelx, DMA_INT_FLAG_FTF)) {
+        events |= DMA_EVENT_FULL_TRANSFER;
+    }
+    if (0 == events) {
+        return;
+    }
+    dma_interrupt_flag_clear(dma_periph, channelx, DMA_INT_FLAG_G);
+    if (events & DMA_EVENT_ERROR) {
+        /* the hardware has already disabled the channel */
+        dma_channel_disable(dma_periph, channelx);
+    }
+    if (NULL != conf->callback) {
+        conf->callback(conf->param, events);
+    }
+}
+
+void DMA0_Channel0_IRQHandler(void)
+{
+    dma_callbackHandler(DMA0, DMA_CH0);
+}
+
+void DMA0_Channel1_IRQHandler(void)
+{
+    dma_callbackHandler(DMA0, DMA_CH1);
+}
+
+void DMA0_Channel2_IRQHandler(void)
+{
+    dma_callbackHandler(DMA0, DMA_CH2);
+}
+
+void DMA0_Channel3_IRQHandler(void)
+{
+    dma_callbackHandler(DMA0, DMA_CH3);
+}
+
+void DMA0_Channel4_IRQHandler(void)
+{
+    dma_callbackHandler(DMA0, DMA_CH4);
+}
+
+void DMA0_Channel5_IRQHandler(void)
+{
+    dma_callbackHandler(DMA0, DMA_CH5);
+}
+
+void DMA0_Channel6_IRQHandler(void)
+{
+    dma_callbackHandler(DMA0, DMA_CH6);
+}
+
+void DMA1_Channel0_IRQHandler(void)
+{
+    dma_callbackHandler(DMA1, DMA_CH0);
+}
+
+void DMA1_Channel1_IRQHandler(void)
+{
+    dma_callbackHandler(DMA1, DMA_CH1);
+}
+
+void DMA1_Channel2_IRQHandler(void)
+{
+    dma_callbackHandler(DMA1, DMA_CH2);
+}
+
+#if defined(GD32F30X_CL) || defined(GD32E50X_CL) || defined(GD32E508)
+void DMA1_Channel3_IRQHandler(void)
+{
+    dma_callbackHandler(DMA1, DMA_CH3);
+}
+
+void DMA1_Channel4_IRQHandler(void)
+{
+    dma_callbackHandler(DMA1, DMA_CH4);
+}
+#else
+void DMA1_Channel3_4_IRQHandler(void)
+{
+    dma_callbackHandler(DMA1, DMA_CH3);
+    dma_callbackHandler(DMA1, DMA_CH4);
+}
+#endif
+
+#else
+
+/* F1x0, F3x0 and E23x: no channel can be claimed, see dma.h */
+
+bool dma_channel_claim(uint32_t dma_periph, dma_channel_enum channelx, dma_callback_t callback,
+                       void *param)
+{
+    (void)dma_periph;
+    (void)channelx;
+    (void)callback;
+    (void)param;
+    return false;
+}
+
+void dma_channel_release(uint32_t dma_periph, dma_channel_enum channelx)
+{
+    (void)dma_periph;
+    (void)channelx;
+}
+
+void dma_channel_start(uint32_t dma_periph, dma_channel_enum channelx, dma_parameter_struct *init,
+                       uint32_t events, bool circular)
+{
+    (void)dma_periph;
+    (void)channelx;
+    (void)init;
+    (void)events;
+    (void)circular;
+}
+
+void dma_channel_stop(uint32_t dma_periph, dma_channel_enum channelx)
+{
+    (void)dma_periph;
+    (void)channelx;
+}
+
+uint32_t dma_channel_remaining(uint32_t dma_periph, dma_channel_enum channelx)
+{
+    (void)dma_periph;
+    (void)channelx;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+    Copyright (c) 2020, GigaDevice Semiconductor Inc.
+
+    Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice, this
+       list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+    3. Neither the name of the copyright holder nor the names of its contributors
+       may be used to endorse or promote products derived from this software without
+       specific prior written permission.
+
+    THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+
+#ifndef _DMA_H_
+#define _DMA_H_
+
+#include "gd32xxyy.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DMA_IRQ_PRIO       1
+#define DMA_IRQ_SUBPRIO    0
+
+/* events reported to a channel callback */
+#define DMA_EVENT_FULL_TRANSFER     BIT(0)
+#define DMA_EVENT_HALF_TRANSFER     BIT(1)
+#define DMA_EVENT_ERROR             BIT(2)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*dma_callback_t)(void *param, uint32_t events);
+
+/*
+ * Channels are shared between several peripherals (see the DMA request
+ * mapping in the user manual), so a driver claims a channel before using
+ * it and releases it when done. Claiming fails on a channel that's already
+ * owned, and always on F1x0, F3x0 and E23x, whose single DMA has a
+ * different register layout and isn't supported: only F30x and E50x get
+ * DMA. Callers are expected to fall back to interrupt-driven transfers.
+ */
+bool dma_channel_claim(uint32_t dma_periph, dma_channel_enum channelx, dma_callback_t callback,
+                       void *param);
+void dma_channel_release(uint32_t dma_periph, dma_channel_enum channelx);
+void dma_channel_start(uint32_t dma_periph, dma_channel_enum channelx, dma_parameter_struct *init,
+                       uint32_t events, bool circular);
+void dma_channel_stop(uint32_t dma_periph, dma_channel_enum channelx);
+uint32_t dma_channel_remaining(uint32_t dma_periph, dma_channel_enum channelx);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* _DMA_H_ */
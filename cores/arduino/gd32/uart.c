@@ -28,16 +28,25 @@ OF SUCH DAMAGE.
 */
 
 #include "uart.h"
+#include "dma.h"
 #include "Arduino.h"
 
 #if defined(USART_DATA)
 #define GD32_USART_TX_DATA USART_DATA
 #define GD32_USART_RX_DATA USART_DATA
 #define GD32_USART_STAT    USART_STAT0
+#define GD32_USART_PERR    USART_STAT0_PERR
+#define GD32_USART_FERR    USART_STAT0_FERR
+#define GD32_USART_NERR    USART_STAT0_NERR
+#define GD32_USART_ORERR   USART_STAT0_ORERR
 #elif defined(USART_RDATA) && defined(USART_TDATA)
 #define GD32_USART_TX_DATA USART_TDATA
 #define GD32_USART_RX_DATA USART_RDATA
 #define GD32_USART_STAT    USART_STAT
+#define GD32_USART_PERR    USART_STAT_PERR
+#define GD32_USART_FERR    USART_STAT_FERR
+#define GD32_USART_NERR    USART_STAT_NERR
+#define GD32_USART_ORERR   USART_STAT_ORERR
 #else
 #error "We don't understand this USART peripheral."
 #endif
@@ -93,6 +102,38 @@ static IRQn_Type usart_irq_n[UART_NUM]      = {
 #endif
 };
 
+#if defined(GD32F30x) || defined(GD32E50X)
+/* DMA channel serving each USART's transmit request, UART4 has none */
+static const uint32_t usart_tx_dma_periph[UART_NUM] = {
+    DMA0,
+    DMA0,
+#if defined(USART2)
+    DMA0,
+#endif
+#if defined(UART3)
+    DMA1,
+#endif
+#if defined(UART4)
+    0
+#endif
+};
+static const dma_channel_enum usart_tx_dma_channel[UART_NUM] = {
+    DMA_CH3,
+    DMA_CH6,
+#if defined(USART2)
+    DMA_CH1,
+#endif
+#if defined(UART3)
+    DMA_CH4,
+#endif
+#if defined(UART4)
+    DMA_CH0
+#endif
+};
+
+static void usart_tx_dma_callback(void *param, uint32_t events);
+#endif
+
 #define GET_SERIAL_S(obj) (obj)
 
 /** Initialize the USART peripheral.
@@ -200,13 +241,28 @@ void serial_free(serial_t *obj)
     struct serial_s *p_obj     = GET_SERIAL_S(obj);
     rcu_periph_enum rcu_periph = usart_clk[p_obj->index];
 
+    serial_tx_dma_enable(obj, 0);
+
     /* reset USART and disable clock */
     usart_deinit(p_obj->uart);
     rcu_periph_clock_disable(rcu_periph);
 
     /* reset the GPIO state */
     pin_function(p_obj->pin_tx, PIN_MODE_IN_FLOATING);
-    pin_function(p_obj->pin_rx, PIN_MODE_IN_FLOATING);
+    if (p_obj->pin_rx != NC) {
+        /* half-duplex ports may have no RX pin */
+        pin_function(p_obj->pin_rx, PIN_MODE_IN_FLOATING);
+    }
+    if (p_obj->pin_rts != NC) {
+        pin_function(p_obj->pin_rts, PIN_MODE_IN_FLOATING);
+    }
+    if (p_obj->pin_cts != NC) {
+        pin_function(p_obj->pin_cts, PIN_MODE_IN_FLOATING);
+    }
+    if (p_obj->pin_de != NC) {
+        pin_function(p_obj->pin_de, PIN_MODE_IN_FLOATING);
+    }
+    p_obj->line_driven = 0;
 }
 
 /** Configure the baud rate
@@ -303,6 +359,230 @@ void serial_format(serial_t *obj, int data_bits, SerialParity parity, int stop_b
     }
 }
 
+/** Configure the serial flow control. With RTS enabled the USART deasserts
+ *  RTS by itself while a received byte is waiting in the data register, so
+ *  leaving that byte unread holds off the remote transmitter.
+ *
+ * @param obj    The serial object
+ * @param type   The type of the flow control
+ * @param rxflow The RTS pin name, NC if unused
+ * @param txflow The CTS pin name, NC if unused
+ */
+void serial_set_flow_control(serial_t *obj, FlowControl type, PinName rxflow, PinName txflow)
+{
+    uint16_t uen_flag = 0U;
+    struct serial_s *p_obj = GET_SERIAL_S(obj);
+
+    /* store the UEN flag */
+    uen_flag = USART_CTL0(p_obj->uart) & USART_CTL0_UEN;
+
+    /* disable the USART first, CTL2 is write protected on some parts while it's enabled */
+    usart_disable(p_obj->uart);
+
+    p_obj->pin_rts = NC;
+    p_obj->pin_cts = NC;
+
+    if (((type == FlowControlRTS) || (type == FlowControlRTSCTS)) && (rxflow != NC)) {
+        pinmap_pinout(rxflow, PinMap_UART_RTS);
+        p_obj->pin_rts = rxflow;
+        usart_hardware_flow_rts_config(p_obj->uart, USART_RTS_ENABLE);
+    } else {
+        usart_hardware_flow_rts_config(p_obj->uart, USART_RTS_DISABLE);
+    }
+
+    if (((type == FlowControlCTS) || (type == FlowControlRTSCTS)) && (txflow != NC)) {
+        pinmap_pinout(txflow, PinMap_UART_CTS);
+        p_obj->pin_cts = txflow;
+        usart_hardware_flow_cts_config(p_obj->uart, USART_CTS_ENABLE);
+    } else {
+        usart_hardware_flow_cts_config(p_obj->uart, USART_CTS_DISABLE);
+    }
+
+    /* restore the UEN flag */
+    if (RESET != uen_flag) {
+        usart_enable(p_obj->uart);
+    }
+}
+
+/** Enable or disable single-wire half-duplex mode. TX and RX share the TX
+ *  pin, which becomes open-drain; the receiver is switched off while
+ *  transmitting so we don't read back our own data.
+ *
+ * @param obj    The serial object
+ * @param enable Non-zero to enable half-duplex mode
+ */
+void serial_set_half_duplex(serial_t *obj, int enable)
+{
+    uint16_t uen_flag = 0U;
+    struct serial_s *p_obj = GET_SERIAL_S(obj);
+    int function = (int)pinmap_function(p_obj->pin_tx, PinMap_UART_TX);
+
+    /* store the UEN flag */
+    uen_flag = USART_CTL0(p_obj->uart) & USART_CTL0_UEN;
+
+    usart_disable(p_obj->uart);
+
+    if (enable) {
+#if defined(GD32F30x) || defined(GD32F10x) || defined(GD32E50X)
+        function = (function & ~PIN_MODE_MASK) | PIN_MODE_AF_OD;
+#else
+        function |= (PIN_OTYPE_OD & PIN_OUTPUT_MODE_MASK) << PIN_OUTPUT_MODE_SHIFT;
+#endif
+        usart_halfduplex_enable(p_obj->uart);
+    } else {
+        usart_halfduplex_disable(p_obj->uart);
+    }
+    pin_function(p_obj->pin_tx, function);
+    p_obj->half_duplex = enable ? 1U : 0U;
+
+    /* restore the UEN flag */
+    if (RESET != uen_flag) {
+        usart_enable(p_obj->uart);
+    }
+}
+
+/** Drive an RS-485 transceiver's driver enable (DE, and /RE tied to it)
+ *  around transmissions. On parts with a hardware DE output the USART does
+ *  the timing itself, on the RTS pin; elsewhere the pin is a GPIO switched
+ *  from the transmit path and the transmit complete interrupt, and both
+ *  delays are busy-waited there, so they are capped at
+ *  SERIAL_DE_DELAY_MAX_US.
+ *
+ * @param obj         The serial object
+ * @param de          The DE pin name, NC to disable
+ * @param active_high Non-zero if DE is asserted high
+ * @param assert_us   Delay between asserting DE and the start bit
+ * @param deassert_us Delay between the last stop bit and releasing DE
+ */
+void serial_set_driver_enable(serial_t *obj, PinName de, int active_high, uint16_t assert_us,
+                              uint16_t deassert_us)
+{
+    struct serial_s *p_obj = GET_SERIAL_S(obj);
+
+    p_obj->pin_de = de;
+    p_obj->de_active_high = active_high ? 1U : 0U;
+#if !defined(USART_CTL2_DEM)
+    if (assert_us > SERIAL_DE_DELAY_MAX_US) {
+        assert_us = SERIAL_DE_DELAY_MAX_US;
+    }
+    if (deassert_us > SERIAL_DE_DELAY_MAX_US) {
+        deassert_us = SERIAL_DE_DELAY_MAX_US;
+    }
+#endif
+    p_obj->de_assert_us = assert_us;
+    p_obj->de_deassert_us = deassert_us;
+
+#if defined(USART_CTL2_DEM)
+    uint16_t uen_flag = USART_CTL0(p_obj->uart) & USART_CTL0_UEN;
+    /* DEA/DED count sample times, 1/16 of a bit */
+    uint32_t dea = ((uint32_t)assert_us * p_obj->baudrate / 62500U) + 1U;
+    uint32_t ded = ((uint32_t)deassert_us * p_obj->baudrate / 62500U) + 1U;
+
+    /* CTL0 and CTL2 are write protected while the USART is enabled */
+    usart_disable(p_obj->uart);
+    if (de != NC) {
+        pinmap_pinout(de, PinMap_UART_RTS);
+        usart_depolarity_config(p_obj->uart, active_high ? USART_DEP_HIGH : USART_DEP_LOW);
+        usart_driver_assertime_config(p_obj->uart, (dea > 31U) ? 31U : dea);
+        usart_driver_deassertime_config(p_obj->uart, (ded > 31U) ? 31U : ded);
+        usart_rs485_driver_enable(p_obj->uart);
+    } else {
+        usart_rs485_driver_disable(p_obj->uart);
+    }
+    if (RESET != uen_flag) {
+        usart_enable(p_obj->uart);
+    }
+#else
+    if (de != NC) {
+        pin_function(de, PIN_MODE_OUT_PP);
+        gpio_bit_write(gpio_port[GD_PORT_GET(de)], gpio_pin[GD_PIN_GET(de)],
+                       active_high ? RESET : SET);
+    }
+#endif
+}
+
+/** Use DMA for serial_transmit(). Each transfer still ends with the transmit
+ *  complete interrupt, so the tx callback and line turnaround are unchanged.
+ *
+ * @param obj    The serial object
+ * @param enable Non-zero to transmit through DMA
+ * @return 1 if DMA is in use, 0 otherwise
+ */
+int serial_tx_dma_enable(serial_t *obj, int enable)
+{
+    struct serial_s *p_obj = GET_SERIAL_S(obj);
+
+#if defined(GD32F30x) || defined(GD32E50X)
+    uint32_t dma_periph = usart_tx_dma_periph[p_obj->index];
+    dma_channel_enum channel = usart_tx_dma_channel[p_obj->index];
+
+    if (enable) {
+        if (!p_obj->tx_dma && (0U != dma_periph) &&
+            dma_channel_claim(dma_periph, channel, usart_tx_dma_callback, p_obj)) {
+            p_obj->tx_dma = 1U;
+        }
+    } else if (p_obj->tx_dma) {
+        usart_dma_transmit_config(p_obj->uart, USART_DENT_DISABLE);
+        dma_channel_release(dma_periph, channel);
+        p_obj->tx_dma = 0U;
+    }
+#else
+    (void)enable;
+#endif
+    return p_obj->tx_dma;
+}
+
+/** Take the line before transmitting: in half-duplex mode stop listening, and
+ *  assert a GPIO driver enable.
+ *
+ * @param obj_s The serial object
+ */
+static void usart_line_acquire(struct serial_s *obj_s)
+{
+    if (obj_s->line_driven) {
+        return;
+    }
+    obj_s->line_driven = 1U;
+    if (obj_s->half_duplex) {
+        usart_receive_config(obj_s->uart, USART_RECEIVE_DISABLE);
+    }
+#if !defined(USART_CTL2_DEM)
+    if (obj_s->pin_de != NC) {
+        gpio_bit_write(gpio_port[GD_PORT_GET(obj_s->pin_de)], gpio_pin[GD_PIN_GET(obj_s->pin_de)],
+                       obj_s->de_active_high ? SET : RESET);
+        if (obj_s->de_assert_us) {
+            delayMicroseconds(obj_s->de_assert_us);
+        }
+    }
+#endif
+}
+
+/** Give the line back once the last stop bit is out. Called from the
+ *  transmit complete interrupt, which the deassert delay holds up for at most
+ *  SERIAL_DE_DELAY_MAX_US.
+ *
+ * @param obj_s The serial object
+ */
+static void usart_line_release(struct serial_s *obj_s)
+{
+    if (!obj_s->line_driven) {
+        return;
+    }
+#if !defined(USART_CTL2_DEM)
+    if (obj_s->pin_de != NC) {
+        if (obj_s->de_deassert_us) {
+            delayMicroseconds(obj_s->de_deassert_us);
+        }
+        gpio_bit_write(gpio_port[GD_PORT_GET(obj_s->pin_de)], gpio_pin[GD_PIN_GET(obj_s->pin_de)],
+                       obj_s->de_active_high ? RESET : SET);
+    }
+#endif
+    if (obj_s->half_duplex) {
+        usart_receive_config(obj_s->uart, USART_RECEIVE_ENABLE);
+    }
+    obj_s->line_driven = 0U;
+}
+
 /** Get character. This is a blocking call, waiting for a character
  *
  * @param obj The serial object
@@ -364,6 +644,25 @@ void serial_clear(serial_t *obj)
     p_obj->rx_count = 0U;
 }
 
+/** Take a consistent snapshot of the serial counters
+ *
+ * @param obj   The serial object
+ * @param stats Where to copy the counters
+ * @param reset Non-zero to zero the counters after copying them
+ */
+void serial_get_stats(serial_t *obj, serial_stats_t *stats, int reset)
+{
+    struct serial_s *p_obj = GET_SERIAL_S(obj);
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    *stats = p_obj->stats;
+    if (reset) {
+        memset(&p_obj->stats, 0, sizeof(p_obj->stats));
+    }
+    __set_PRIMASK(primask);
+}
+
 /** Attempts to determine if the serial peripheral is already in use for TX
  *
  * @param obj The serial object
@@ -516,7 +815,33 @@ static void usart_tx_complete_interrupt(struct serial_s *obj_s)
 
     obj_s->tx_state = OP_STATE_READY;
     obj_s->tx_callback(obj_s);
+
+    /* turn the line around, unless the callback queued more data */
+    if (obj_s->tx_state == OP_STATE_READY) {
+        usart_line_release(obj_s);
+    }
+}
+
+#if defined(GD32F30x) || defined(GD32E50X)
+/** Handle the end of a DMA transmission: the last byte is in the data
+ *  register, so wait for transmit complete as the interrupt path does.
+ *
+ * @param param  The serial object
+ * @param events The DMA events that occurred
+ */
+static void usart_tx_dma_callback(void *param, uint32_t events)
+{
+    struct serial_s *obj_s = (struct serial_s *)param;
+
+    usart_dma_transmit_config(obj_s->uart, USART_DENT_DISABLE);
+    dma_channel_stop(usart_tx_dma_periph[obj_s->index], usart_tx_dma_channel[obj_s->index]);
+    if (events & DMA_EVENT_ERROR) {
+        obj_s->error_code |= SERIAL_EVENT_ERROR;
+    }
+    obj_s->tx_count = 0U;
+    usart_interrupt_enable(obj_s->uart, USART_INT_TC);
 }
+#endif
 
 /**
  * Preprocess the USART tx interrupt
@@ -611,6 +936,35 @@ int serial_transmit(serial_t *obj, const void *tx, size_t tx_length)
     /* enable IRQ */
     NVIC_EnableIRQ(irq);
 
+    usart_line_acquire(p_obj);
+
+#if defined(GD32F30x) || defined(GD32E50X)
+    if (p_obj->tx_dma) {
+        dma_parameter_struct dma_init_struct;
+        int wide = (p_obj->databits == USART_WL_9BIT) && (p_obj->parity == USART_PM_NONE);
+
+        p_obj->tx_state = OP_STATE_BUSY_TX;
+        /* TC must only fire once the last DMA byte is out */
+        usart_flag_clear(p_obj->uart, USART_FLAG_TC);
+
+        dma_struct_para_init(&dma_init_struct);
+        dma_init_struct.periph_addr  = (uint32_t)&USART_DATA(p_obj->uart);
+        dma_init_struct.periph_width = wide ? DMA_PERIPHERAL_WIDTH_16BIT : DMA_PERIPHERAL_WIDTH_8BIT;
+        dma_init_struct.memory_addr  = (uint32_t)tx;
+        dma_init_struct.memory_width = wide ? DMA_MEMORY_WIDTH_16BIT : DMA_MEMORY_WIDTH_8BIT;
+        dma_init_struct.number       = tx_length;
+        dma_init_struct.priority     = DMA_PRIORITY_MEDIUM;
+        dma_init_struct.periph_inc   = DMA_PERIPH_INCREASE_DISABLE;
+        dma_init_struct.memory_inc   = DMA_MEMORY_INCREASE_ENABLE;
+        dma_init_struct.direction    = DMA_MEMORY_TO_PERIPHERAL;
+        dma_channel_start(usart_tx_dma_periph[p_obj->index], usart_tx_dma_channel[p_obj->index],
+                          &dma_init_struct, DMA_EVENT_FULL_TRANSFER | DMA_EVENT_ERROR, false);
+        usart_dma_transmit_config(p_obj->uart, USART_DENT_ENABLE);
+
+        return tx_length;
+    }
+#endif
+
     if (usart_tx_interrupt_preprocess(p_obj, (uint8_t *)tx, tx_length) != GD_OK) {
         return 0;
     }
@@ -654,6 +1008,37 @@ void serial_receive(serial_t *obj, void *rx, size_t rx_length)
     usart_rx_interrupt_preprocess(p_obj, (uint8_t *)rx, rx_length);
 }
 
+/** Count and clear receive errors. Reading the data register clears the
+ *  error flags (and drops the damaged byte); parts with a separate RDATA
+ *  register also need the flags cleared explicitly.
+ *
+ * @param obj_s     The serial object
+ * @param err_flags The error bits of the status register
+ */
+static void usart_rx_error(struct serial_s *obj_s, uint32_t err_flags)
+{
+    if (err_flags & GD32_USART_ORERR) {
+        obj_s->stats.overrun_errors++;
+    }
+    if (err_flags & GD32_USART_FERR) {
+        obj_s->stats.framing_errors++;
+    }
+    if (err_flags & GD32_USART_NERR) {
+        obj_s->stats.noise_errors++;
+    }
+    if (err_flags & GD32_USART_PERR) {
+        obj_s->stats.parity_errors++;
+    }
+
+    GD32_USART_RX_DATA(obj_s->uart);
+#if defined(USART_RDATA)
+    usart_flag_clear(obj_s->uart, USART_FLAG_ORERR);
+    usart_flag_clear(obj_s->uart, USART_FLAG_FERR);
+    usart_flag_clear(obj_s->uart, USART_FLAG_NERR);
+    usart_flag_clear(obj_s->uart, USART_FLAG_PERR);
+#endif
+}
+
 /** This function handles USART interrupt handler
  *
  * @param usart_periph The UART peripheral
@@ -663,8 +1048,8 @@ static void usart_irq(struct serial_s *obj_s)
     uint32_t err_flags = 0U;
 
     /* no error occurs */
-    err_flags = (GD32_USART_STAT(obj_s->uart) & (uint32_t)(USART_FLAG_PERR | USART_FLAG_FERR |
-                                                           USART_FLAG_ORERR | USART_FLAG_NERR));
+    err_flags = (GD32_USART_STAT(obj_s->uart) & (uint32_t)(GD32_USART_PERR | GD32_USART_FERR |
+                                                           GD32_USART_ORERR | GD32_USART_NERR));
     if (err_flags == RESET) {
         /* check whether USART is in receiver mode or not */
         if (usart_interrupt_flag_get(obj_s->uart, USART_INT_FLAG_RBNE) != RESET) {
@@ -686,24 +1071,8 @@ static void usart_irq(struct serial_s *obj_s)
         return;
     }
 
-    if (usart_interrupt_flag_get(obj_s->uart, USART_INT_FLAG_ERR_ORERR) != RESET) {
-        /* clear ORERR error flag by reading USART DATA register */
-        GD32_USART_RX_DATA(obj_s->uart);
-    }
-
-    if (usart_interrupt_flag_get(obj_s->uart, USART_INT_FLAG_ERR_NERR) != RESET) {
-        /* clear NERR error flag by reading USART DATA register */
-        GD32_USART_RX_DATA(obj_s->uart);
-    }
-
-    if (usart_interrupt_flag_get(obj_s->uart, USART_INT_FLAG_ERR_FERR) != RESET) {
-        /* clear FERR error flag by reading USART DATA register */
-        GD32_USART_RX_DATA(obj_s->uart);
-    }
-
-    if (usart_interrupt_flag_get(obj_s->uart, USART_INT_FLAG_PERR) != RESET) {
-        /* clear PERR error flag by reading USART DATA register */
-        GD32_USART_RX_DATA(obj_s->uart);
+    if (err_flags != RESET) {
+        usart_rx_error(obj_s, err_flags);
     }
 }
 
@@ -48,6 +48,15 @@ extern "C" {
 
 #define SERIAL_EVENT_ERROR (1 << 1)
 
+/*
+ * Longest RS-485 driver enable guard time on parts without a hardware DE
+ * output. There the delays are busy-waited, the deassert one in the
+ * transmit complete interrupt, so longer requests are cut down to this.
+ */
+#ifndef SERIAL_DE_DELAY_MAX_US
+#define SERIAL_DE_DELAY_MAX_US (50)
+#endif
+
 /**
  * @defgroup SerialTXEvents Serial TX Events Macros
  *
@@ -113,14 +122,36 @@ typedef enum {
     ParityForced0 = 4
 } SerialParity;
 
+typedef enum {
+    FlowControlNone,
+    FlowControlRTS,
+    FlowControlCTS,
+    FlowControlRTSCTS
+} FlowControl;
+
 typedef struct serial_s serial_t;
 
+/* Per-port counters, updated from interrupt context */
+typedef struct {
+    uint32_t rx_bytes;          /* bytes received */
+    uint32_t tx_bytes;          /* bytes transmitted */
+    uint32_t rx_dropped;        /* bytes lost because the receive buffer was full */
+    uint32_t rx_peak;           /* highest receive buffer occupancy seen */
+    uint32_t overrun_errors;    /* ORERR: a byte arrived before the previous one was read */
+    uint32_t framing_errors;    /* FERR: missing stop bit, usually a baud rate mismatch */
+    uint32_t noise_errors;      /* NERR: noise detected while sampling */
+    uint32_t parity_errors;     /* PERR */
+} serial_stats_t;
+
 struct serial_s {
     /* basic information */
     UARTName uart;
     int     index;
     PinName pin_tx;
     PinName pin_rx;
+    PinName pin_rts;
+    PinName pin_cts;
+    PinName pin_de;
 
     /* configure information */
     uint32_t baudrate;
@@ -144,6 +175,18 @@ struct serial_s {
     operation_state_enum  tx_state;
     operation_state_enum  rx_state;
 
+    /* half-duplex and RS-485 line turnaround */
+    uint8_t    half_duplex;
+    uint8_t    de_active_high;
+    uint16_t   de_assert_us;
+    uint16_t   de_deassert_us;
+    volatile uint8_t line_driven;
+
+    /* transmit through DMA rather than the TBE interrupt */
+    uint8_t    tx_dma;
+
+    serial_stats_t stats;
+
     void (*tx_callback)(serial_t *obj);
     void (*rx_callback)(serial_t *obj);
 };
@@ -156,6 +199,15 @@ void serial_free(serial_t *obj);
 void serial_baud(serial_t *obj, int baudrate);
 /* Configure the format. Set the number of bits, parity and the number of stop bits. */
 void serial_format(serial_t *obj, int data_bits, SerialParity parity, int stop_bits);
+/* Configure the serial flow control. */
+void serial_set_flow_control(serial_t *obj, FlowControl type, PinName rxflow, PinName txflow);
+/* Enable or disable single-wire half-duplex mode on the TX pin. */
+void serial_set_half_duplex(serial_t *obj, int enable);
+/* Drive an RS-485 transceiver's driver enable pin around transmissions. */
+void serial_set_driver_enable(serial_t *obj, PinName de, int active_high, uint16_t assert_us,
+                              uint16_t deassert_us);
+/* Send serial_transmit() data through DMA, if the USART has a free DMA channel. */
+int serial_tx_dma_enable(serial_t *obj, int enable);
 /* Get character. This is a blocking call, waiting for a character. */
 int  serial_getc(serial_t *obj);
 /* Send a character. This is a blocking call, waiting for a peripheral to be available for writing. */
@@ -166,6 +218,8 @@ int  serial_readable(serial_t *obj);
 int  serial_writable(serial_t *obj);
 /* Clear the serial peripheral. */
 void serial_clear(serial_t *obj);
+/* Take a consistent snapshot of the serial counters. */
+void serial_get_stats(serial_t *obj, serial_stats_t *stats, int reset);
 /* Attempts to determine if the serial peripheral is already in use for TX. */
 uint8_t serial_tx_active(serial_t *obj);
 /* Attempts to determine if the serial peripheral is already in use for RX. */
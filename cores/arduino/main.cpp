@@ -60,6 +60,9 @@ int main(void)
 
     while (1) {
         loop();
+        if (serialEventRun) {
+            serialEventRun();
+        }
     }
     return 0;
 }
@@ -36,6 +36,13 @@ SPIClass::SPIClass(void)
     _spi.pin_ssel = NC;
 
     initialized = false;
+    _queue_head = NULL;
+    _queue_tail = NULL;
+    _job_running = NULL;
+    _selected = NULL;
+    _locked = false;
+    _async_callback = NULL;
+    _async_param = NULL;
 }
 
 SPIClass::SPIClass(PinName mosi, PinName miso, PinName sclk, PinName ssel)
@@ -46,6 +53,13 @@ SPIClass::SPIClass(PinName mosi, PinName miso, PinName sclk, PinName ssel)
     _spi.pin_ssel = ssel;
 
     initialized = false;
+    _queue_head = NULL;
+    _queue_tail = NULL;
+    _job_running = NULL;
+    _selected = NULL;
+    _locked = false;
+    _async_callback = NULL;
+    _async_param = NULL;
 }
 
 SPIClass::SPIClass(PinName mosi, PinName miso, PinName sclk)
@@ -56,6 +70,13 @@ SPIClass::SPIClass(PinName mosi, PinName miso, PinName sclk)
     _spi.pin_ssel = NC;
 
     initialized = false;
+    _queue_head = NULL;
+    _queue_tail = NULL;
+    _job_running = NULL;
+    _selected = NULL;
+    _locked = false;
+    _async_callback = NULL;
+    _async_param = NULL;
 }
 
 void SPIClass::begin()
@@ -65,39 +86,322 @@ void SPIClass::begin()
         return;
     }
 
-    spi_begin(&_spi, spisettings.speed, spisettings.datamode, spisettings.bitorder);
+    spi_begin(&_spi, spisettings.speed, spisettings.datamode, spisettings.bitorder,
+              spisettings.datasize);
+    _settings_cached = 0;
+    _settings_cache_next = 0;
 
     initialized = true;
 }
 
 void SPIClass::end()
 {
-    if (initialized) {
-        spi_free(&_spi);
+    if (initialized && _spi.slave) {
+        spi_slave_end(&_spi);
         initialized = false;
+    } else if (initialized) {
+        uint32_t primask = __get_PRIMASK();
+
+        /* no job starts from here on, the one running is let finish */
+        __disable_irq();
+        initialized = false;
+        __set_PRIMASK(primask);
+        while ((NULL != _job_running) || spi_master_busy(&_spi)) {
+        }
+        abortQueue();
+        spi_free(&_spi);
     }
 }
 
-void SPIClass::beginTransaction(SPISettings settings)
+SPIDevice::SPIDevice(SPIClass &spi, uint8_t csPin, SPISettings settings, bool csActiveHigh) :
+    _spi(spi), _settings(settings), _cs(csPin), _cs_high(csActiveHigh), _cs_port(0), _cs_pin(0)
+{
+}
+
+void SPIDevice::begin(void)
+{
+    if (SPI_CS_PIN_NONE == _cs) {
+        return;
+    }
+    _cs_port = DIGITAL_PIN_TO_PORT(_cs);
+    _cs_pin = gpio_pin[GD_PIN_GET(DIGITAL_TO_PINNAME(_cs))];
+    pinMode(_cs, OUTPUT);
+    deselect();
+}
+
+void SPIDevice::beginTransaction(void)
+{
+    _spi.beginTransaction(_settings);
+    select();
+}
+
+void SPIDevice::endTransaction(void)
 {
-    config(settings);
+    deselect();
+    _spi.endTransaction();
+}
 
-    spi_begin(&_spi, spisettings.speed, spisettings.datamode, spisettings.bitorder);
+void SPIDevice::select(void)
+{
+    if (SPI_CS_PIN_NONE == _cs) {
+        return;
+    }
+    if (_cs_high) {
+        gpio_bit_set(_cs_port, _cs_pin);
+    } else {
+        gpio_bit_reset(_cs_port, _cs_pin);
+    }
+}
 
+void SPIDevice::deselect(void)
+{
+    if (SPI_CS_PIN_NONE == _cs) {
+        return;
+    }
+    if (_cs_high) {
+        gpio_bit_reset(_cs_port, _cs_pin);
+    } else {
+        gpio_bit_set(_cs_port, _cs_pin);
+    }
+}
+
+bool SPIClass::beginSlave(uint8_t mode, BitOrder bitOrder, uint8_t *rxBuffers, uint8_t *txBuffers,
+                          uint16_t length,
+                          void (*onFrame)(void *param, uint8_t *rx, uint16_t count, uint8_t *tx),
+                          void *param)
+{
+    end();
+    if (!spi_slave_begin(&_spi, mode, bitOrder, rxBuffers, txBuffers, length, onFrame, param)) {
+        return false;
+    }
     initialized = true;
+    return true;
+}
+
+void SPIClass::beginTransaction(SPISettings settings)
+{
+    _locked = true;
+    /* let a running job, or a chain of jobs holding a chip select, finish */
+    while ((NULL != _selected) || (NULL != _job_running)) {
+    }
+    waitIdle();
+    if (!initialized) {
+        config(settings);
+        begin();
+        return;
+    }
+    if (settings != spisettings) {
+        config(settings);
+        applySettings();
+    }
 }
 
 void SPIClass::endTransaction(void)
 {
-    if (initialized) {
-        spi_free(&_spi);
-        initialized = false;
+    /* the peripheral stays configured for the next transaction, end() releases it */
+    waitIdle();
+    _locked = false;
+    runQueue();
+}
+
+/*!
+    \brief      queue jobs for devices on this bus
+    \param[in]  jobs: the jobs, run in order
+    \param[in]  count: number of jobs
+    \param[out] none
+    \retval     false if nothing was queued
+*/
+bool SPIClass::submit(SPIJob *jobs, uint16_t count)
+{
+    if (!initialized || _spi.slave || (NULL == jobs) || (0 == count)) {
+        return false;
+    }
+    for (uint16_t i = 0; i < count; i++) {
+        if (NULL == jobs[i].device) {
+            return false;
+        }
+        jobs[i].status = SPI_JOB_QUEUED;
+        jobs[i].aborted = false;
+        jobs[i].next = (i + 1 < count) ? &jobs[i + 1] : NULL;
+        jobs[i].last = (i + 1 == count);
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (NULL == _queue_head) {
+        _queue_head = jobs;
+    } else {
+        _queue_tail->next = jobs;
+    }
+    _queue_tail = &jobs[count - 1];
+    __set_PRIMASK(primask);
+
+    runQueue();
+    return true;
+}
+
+/*
+ * Start the job at the head of the queue, unless one is running, a
+ * transferAsync() is or a blocking transaction has the bus. With nothing
+ * else on the SPI, a job only fails to start by DMA when there is none for
+ * this SPI or its channels are taken; it is then run polled, right here.
+ */
+void SPIClass::runQueue(void)
+{
+    while (true) {
+        SPIJob *job;
+        uint32_t primask = __get_PRIMASK();
+
+        __disable_irq();
+        job = _queue_head;
+        /* a chain that holds a chip select runs to its end regardless */
+        if ((NULL == job) || (NULL != _job_running) || !initialized || spi_master_busy(&_spi) ||
+            (_locked && (NULL == _selected))) {
+            __set_PRIMASK(primask);
+            return;
+        }
+        _job_running = job;
+        __set_PRIMASK(primask);
+
+        job->status = SPI_JOB_RUNNING;
+        SPIDevice *device = job->device;
+        if ((NULL != _selected) && (_selected != device)) {
+            _selected->deselect();
+        }
+        if (device->_settings != spisettings) {
+            config(device->_settings);
+            applySettings();
+        }
+        device->select();
+        _selected = device;
+
+        if (0 == job->length) {
+            completeJob(job);
+            continue;
+        }
+        /* the frame size of the device's settings picks byte or word buffers */
+        if (SPI_DATA_SIZE_16BIT == spisettings.datasize) {
+            if (spi_master_transfer_dma16(&_spi, (const uint16_t *)job->tx, (uint16_t *)job->rx,
+                                          job->length, onJobDone, this)) {
+                return;
+            }
+            spi_master_block_transfer16(&_spi, (const uint16_t *)job->tx, (uint16_t *)job->rx,
+                                        job->length);
+        } else {
+            if (spi_master_transfer_dma(&_spi, (const uint8_t *)job->tx, (uint8_t *)job->rx,
+                                        job->length, onJobDone, this)) {
+                return;
+            }
+            spi_master_block_transfer(&_spi, (const uint8_t *)job->tx, (uint8_t *)job->rx, job->length);
+        }
+        completeJob(job);
+    }
+}
+
+/* Retire the running job: release its chip select at the end of its chain */
+void SPIClass::completeJob(SPIJob *job)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    _queue_head = job->next;
+    if (NULL == _queue_head) {
+        _queue_tail = NULL;
+    }
+    __set_PRIMASK(primask);
+
+    if (job->last) {
+        job->device->deselect();
+        _selected = NULL;
     }
+    job->status = SPI_JOB_DONE;
+    _job_running = NULL;
+    if (NULL != job->callback) {
+        job->callback(job, job->param);
+    }
+}
+
+void SPIClass::onJobDone(void *param)
+{
+    SPIClass *spi = (SPIClass *)param;
+
+    spi->completeJob(spi->_job_running);
+    spi->runQueue();
+}
+
+/*
+ * Drop the jobs end() didn't let run: each is marked aborted and done, and
+ * its callback called, from end()'s context
+ */
+void SPIClass::abortQueue(void)
+{
+    SPIJob *job;
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    job = _queue_head;
+    _queue_head = NULL;
+    _queue_tail = NULL;
+    __set_PRIMASK(primask);
+
+    if (NULL != _selected) {
+        _selected->deselect();
+        _selected = NULL;
+    }
+    while (NULL != job) {
+        /* the callback may hand the job straight back to submit() */
+        SPIJob *next = job->next;
+
+        job->aborted = true;
+        job->status = SPI_JOB_DONE;
+        if (NULL != job->callback) {
+            job->callback(job, job->param);
+        }
+        job = next;
+    }
+}
+
+/*
+ * Start a transferAsync() unless a job or another transfer has the SPI;
+ * with interrupts off, so the queue can't slip a job in alongside it
+ */
+bool SPIClass::startAsync(const void *bufout, void *bufin, uint16_t count, bool wide,
+                          void (*callback)(void *), void *param)
+{
+    bool started = false;
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if ((NULL == _job_running) && (NULL == _selected) && !spi_master_busy(&_spi)) {
+        _async_callback = callback;
+        _async_param = param;
+        if (wide) {
+            started = spi_master_transfer_dma16(&_spi, (const uint16_t *)bufout, (uint16_t *)bufin,
+                                                count, onAsyncDone, this);
+        } else {
+            started = spi_master_transfer_dma(&_spi, (const uint8_t *)bufout, (uint8_t *)bufin,
+                                              count, onAsyncDone, this);
+        }
+    }
+    __set_PRIMASK(primask);
+    return started;
+}
+
+/* transferAsync() completion: the caller's callback, then the jobs held back */
+void SPIClass::onAsyncDone(void *param)
+{
+    SPIClass *spi = (SPIClass *)param;
+
+    if (NULL != spi->_async_callback) {
+        spi->_async_callback(spi->_async_param);
+    }
+    spi->runQueue();
 }
 
 uint8_t SPIClass::transfer(uint8_t val8)
 {
     uint32_t out_byte;
+    waitIdle();
     out_byte = spi_master_write(&_spi, val8);
 
     return out_byte;
@@ -108,17 +412,22 @@ uint16_t SPIClass::transfer16(uint16_t val16)
     uint16_t out_halfword;
     uint8_t trans_data0, trans_data1, rec_data0, rec_data1;
 
+    if (spisettings.datasize == SPI_DATA_SIZE_16BIT) {
+        waitIdle();
+        return spi_master_write16(&_spi, val16);
+    }
+
     trans_data0 = uint8_t(val16 & 0x00FF);
     trans_data1 = uint8_t((val16 & 0xFF00) >> 8);
 
     if (spisettings.bitorder == LSBFIRST) {
         rec_data0 = transfer(trans_data0);
         rec_data1 = transfer(trans_data1);
-        out_halfword = uint16_t(rec_data0 || rec_data1 << 8);
+        out_halfword = uint16_t(rec_data0 | rec_data1 << 8);
     } else {
         rec_data0 = transfer(trans_data1);
         rec_data1 = transfer(trans_data0);
-        out_halfword = uint16_t(rec_data1 || rec_data0 << 8);
+        out_halfword = uint16_t(rec_data1 | rec_data0 << 8);
     }
 
     return out_halfword;
@@ -126,28 +435,85 @@ uint16_t SPIClass::transfer16(uint16_t val16)
 
 void SPIClass::transfer(void *buf, size_t count)
 {
-    spi_master_block_write(&_spi, ((uint8_t *)buf), ((uint8_t *)buf), count);
+    transfer(buf, buf, count);
+}
+
+void SPIClass::transfer(const void *bufout, void *bufin, size_t count)
+{
+    waitIdle();
+    spi_master_block_transfer(&_spi, (const uint8_t *)bufout, (uint8_t *)bufin, count);
+}
+
+void SPIClass::transmit(const void *buf, size_t count)
+{
+    transfer(buf, NULL, count);
+}
+
+void SPIClass::receive(void *buf, size_t count)
+{
+    transfer(NULL, buf, count);
+}
+
+bool SPIClass::transferAsync(const void *bufout, void *bufin, size_t count,
+                             void (*callback)(void *), void *param)
+{
+    if (!initialized || (count > 0xFFFF)) {
+        return false;
+    }
+    return startAsync(bufout, bufin, (uint16_t)count, false, callback, param);
+}
+
+bool SPIClass::finished(void)
+{
+    return !spi_master_busy(&_spi);
+}
+
+void SPIClass::transfer16(uint16_t *buf, size_t count)
+{
+    transfer16(buf, buf, count);
+}
+
+void SPIClass::transfer16(const uint16_t *bufout, uint16_t *bufin, size_t count)
+{
+    waitIdle();
+    if (spisettings.datasize == SPI_DATA_SIZE_16BIT) {
+        spi_master_block_transfer16(&_spi, bufout, bufin, count);
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        uint16_t in = transfer16((NULL != bufout) ? bufout[i] : (uint16_t)SPI_FILL_WORD);
+        if (NULL != bufin) {
+            bufin[i] = in;
+        }
+    }
 }
 
-void SPIClass::transfer(void *bufout, void *bufin, size_t count)
+bool SPIClass::transfer16Async(const uint16_t *bufout, uint16_t *bufin, size_t count,
+                               void (*callback)(void *), void *param)
 {
-    spi_master_block_write(&_spi, ((uint8_t *)bufout), ((uint8_t *)bufin), count);
+    if (!initialized || (count > 0xFFFF) || (spisettings.datasize != SPI_DATA_SIZE_16BIT)) {
+        return false;
+    }
+    return startAsync(bufout, bufin, (uint16_t)count, true, callback, param);
 }
 
 void SPIClass::setBitOrder(BitOrder order)
 {
+    waitIdle();
     spisettings.bitorder = order;
-    spi_begin(&_spi, spisettings.speed, spisettings.datamode, spisettings.bitorder);
+    applySettings();
 }
 
 void SPIClass::setDataMode(uint8_t mode)
 {
+    waitIdle();
     spisettings.datamode = mode;
-    spi_begin(&_spi, spisettings.speed, spisettings.datamode, spisettings.bitorder);
+    applySettings();
 }
 
 void SPIClass::setClockDivider(uint32_t divider)
 {
+    waitIdle();
     if (divider == 0) {
         spisettings.speed = SPI_SPEED_DEFAULT;
     } else {
@@ -155,12 +521,46 @@ void SPIClass::setClockDivider(uint32_t divider)
         spisettings.speed = dev_spi_clock_source_frequency_get(&_spi) / divider;
     }
 
-    spi_begin(&_spi, spisettings.speed, spisettings.datamode, spisettings.bitorder);
+    applySettings();
 }
 
 void SPIClass::config(SPISettings settings)
 {
     spisettings.speed = settings.speed;
     spisettings.datamode = settings.datamode;
+    spisettings.datasize = settings.datasize;
     spisettings.bitorder = settings.bitorder;
 }
+
+/* Wait for a transferAsync() to finish */
+void SPIClass::waitIdle(void)
+{
+    while (initialized && spi_master_busy(&_spi)) {
+    }
+}
+
+/* Load spisettings into the peripheral, through the settings cache */
+void SPIClass::applySettings(void)
+{
+    if (!initialized || _spi.slave) {
+        /* begin() will pick spisettings up */
+        return;
+    }
+
+    for (uint8_t i = 0; i < _settings_cached; i++) {
+        if (_settings_cache[i].settings == spisettings) {
+            spi_apply_params(&_spi, &_settings_cache[i].params);
+            return;
+        }
+    }
+
+    CachedSettings *entry = &_settings_cache[_settings_cache_next];
+    _settings_cache_next = (_settings_cache_next + 1) % SPI_SETTINGS_CACHE_SIZE;
+    if (_settings_cached < SPI_SETTINGS_CACHE_SIZE) {
+        _settings_cached++;
+    }
+    entry->settings = spisettings;
+    spi_compute_params(&_spi, spisettings.speed, spisettings.datamode, spisettings.bitorder,
+                       spisettings.datasize, &entry->params);
+    spi_apply_params(&_spi, &entry->params);
+}
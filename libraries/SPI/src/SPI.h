@@ -38,14 +38,31 @@ extern "C" {
  */
 #define SPI_HAS_TRANSACTION 1
 
+/* Number of distinct SPISettings whose peripheral configuration is kept */
+#ifndef SPI_SETTINGS_CACHE_SIZE
+#define SPI_SETTINGS_CACHE_SIZE 4
+#endif
+
+/* csPin for an SPIDevice without a chip select, such as an LED strip */
+#ifndef SPI_CS_PIN_NONE
+#define SPI_CS_PIN_NONE 0xFF
+#endif
+
 class SPISettings
 {
     public:
-        SPISettings(uint32_t speedMax, BitOrder bitOrder, uint8_t dataMode)
+        /*
+         * dataSize is SPI_DATA_SIZE_8BIT or SPI_DATA_SIZE_16BIT. With 16-bit
+         * frames every frame goes through the data register as a whole:
+         * use transfer16() and the word buffer transfers, not the byte ones.
+         */
+        SPISettings(uint32_t speedMax, BitOrder bitOrder, uint8_t dataMode,
+                    uint8_t dataSize = SPI_DATA_SIZE_8BIT)
         {
             this->speed = speedMax;
             this->bitorder = bitOrder;
             this->datamode = dataMode;
+            this->datasize = dataSize;
         }
 
         /* Set speed to default, SPI mode set to MODE 0 and Bit order set to MSB first. */
@@ -54,11 +71,23 @@ class SPISettings
             this->speed = SPI_SPEED_DEFAULT;
             this->bitorder = MSBFIRST;
             this->datamode = SPI_MODE0;
+            this->datasize = SPI_DATA_SIZE_8BIT;
+        }
+
+        bool operator==(const SPISettings &rhs) const
+        {
+            return (speed == rhs.speed) && (datamode == rhs.datamode) && (bitorder == rhs.bitorder) &&
+                   (datasize == rhs.datasize);
+        }
+        bool operator!=(const SPISettings &rhs) const
+        {
+            return !(*this == rhs);
         }
 
     private:
         uint32_t speed;
         uint8_t datamode;
+        uint8_t datasize;
         BitOrder bitorder;
 
         friend class SPIClass;
@@ -66,6 +95,75 @@ class SPISettings
 
 const SPISettings DEFAULT_SPI_SETTINGS = SPISettings();
 
+class SPIClass;
+
+/*
+ * A device on a shared bus: its chip select and settings. Its transactions
+ * switch the bus settings only when they differ from the last device's.
+ */
+class SPIDevice
+{
+    public:
+        SPIDevice(SPIClass &spi, uint8_t csPin, SPISettings settings, bool csActiveHigh = false);
+
+        // CS pin as an output, deselected; csPin may be SPI_CS_PIN_NONE
+        void begin(void);
+
+        // Blocking transaction: takes the bus from the job queue, which
+        // resumes at endTransaction(), and selects the device
+        void beginTransaction(void);
+        void endTransaction(void);
+
+        void select(void);
+        void deselect(void);
+
+        SPIClass &bus(void)
+        {
+            return _spi;
+        }
+
+    private:
+        SPIClass &_spi;
+        SPISettings _settings;
+        uint8_t _cs;
+        bool _cs_high;
+        uint32_t _cs_port;
+        uint32_t _cs_pin;
+
+        friend class SPIClass;
+};
+
+enum {
+    SPI_JOB_DONE = 0,
+    SPI_JOB_QUEUED,
+    SPI_JOB_RUNNING,
+};
+
+/*
+ * A queued transfer, see SPIClass::submit(). The job and its buffers belong
+ * to the queue until its status is SPI_JOB_DONE.
+ */
+struct SPIJob {
+    SPIDevice *device;
+    // NULL sends SPI_FILL_BYTE, or SPI_FILL_WORD
+    const void *tx;
+    // NULL discards what comes back, may be tx
+    void *rx;
+    // frames: bytes, or 16-bit words when the device's settings use
+    // SPI_DATA_SIZE_16BIT; 0 only toggles the chip select
+    uint16_t length;
+    // called from interrupt context once the job is done, may be NULL
+    void (*callback)(SPIJob *job, void *param);
+    void *param;
+    volatile uint8_t status;
+    // done without running: SPIClass::end() dropped it from the queue
+    bool aborted;
+
+    // set up by submit()
+    SPIJob *next;
+    bool last;
+};
+
 class SPIClass
 {
     public:
@@ -74,15 +172,64 @@ class SPIClass
         SPIClass(PinName mosi, PinName miso, PinName sclk);
 
         void begin();
+        // Waits for a running job or transferAsync(); jobs still queued are
+        // dropped, see SPIJob::aborted
         void end();
 
+        // Slave mode, on series with SPI DMA; NSS is the ssel pin given to
+        // the constructor. Frames of up to length bytes are exchanged by DMA
+        // with no per-byte interrupts, alternating between the two halves of
+        // rxBuffers and txBuffers (2 * length bytes each). When the master
+        // raises NSS, onFrame gets the half received into, the number of
+        // bytes clocked and the half just sent, which may be refilled for the
+        // frame after next; from interrupt context. A NULL txBuffers sends
+        // SPI_FILL_BYTE. The master has to leave a few microseconds between
+        // frames. end() leaves slave mode.
+        bool beginSlave(uint8_t mode, BitOrder bitOrder, uint8_t *rxBuffers, uint8_t *txBuffers,
+                        uint16_t length,
+                        void (*onFrame)(void *param, uint8_t *rx, uint16_t count, uint8_t *tx) = NULL,
+                        void *param = NULL);
+
+        // Take the bus for blocking transfers; queued jobs wait until
+        // endTransaction(), one already running finishes first. Only call
+        // it from the main loop, interrupts use submit().
         void beginTransaction(SPISettings settings);
         void endTransaction(void);
 
+        // Queue count jobs to run back to back, by DMA where available, from
+        // the main loop or an interrupt. A device's chip select stays
+        // asserted across consecutive jobs for it in the array, and is
+        // released after the last one. Returns false if a job has no device
+        // or the bus isn't begun.
+        bool submit(SPIJob *jobs, uint16_t count = 1);
+
         uint8_t transfer(uint8_t val8);
         uint16_t transfer16(uint16_t val16);
         void transfer(void *buf, size_t count);
-        void transfer(void *bufout, void *bufin, size_t count);
+
+        // Block transfers, by DMA where available once they are
+        // SPI_DMA_THRESHOLD bytes or more. A NULL bufout sends SPI_FILL_BYTE
+        // and a NULL bufin discards what comes back; bufin may be bufout.
+        void transfer(const void *bufout, void *bufin, size_t count);
+        void transmit(const void *buf, size_t count);
+        void receive(void *buf, size_t count);
+
+        // Non-blocking DMA block transfer of up to 65535 bytes. Returns false
+        // if it couldn't be started: no DMA on this series, its channels are
+        // taken, or a transfer or queued job is already running. The buffers
+        // belong to the transfer until finished(); callback is then called
+        // from the DMA interrupt. Other calls on this SPI wait for it to
+        // finish, queued jobs start once it has.
+        bool transferAsync(const void *bufout, void *bufin, size_t count,
+                           void (*callback)(void *) = NULL, void *param = NULL);
+        bool finished(void);
+
+        // Word buffer transfers, for settings with SPI_DATA_SIZE_16BIT:
+        // one frame per element, NULL bufout sends SPI_FILL_WORD
+        void transfer16(uint16_t *buf, size_t count);
+        void transfer16(const uint16_t *bufout, uint16_t *bufin, size_t count);
+        bool transfer16Async(const uint16_t *bufout, uint16_t *bufin, size_t count,
+                             void (*callback)(void *) = NULL, void *param = NULL);
 
         void setBitOrder(BitOrder order);
         void setDataMode(uint8_t mode);
@@ -90,11 +237,43 @@ class SPIClass
 
     private:
         void config(SPISettings settings);
+        void applySettings(void);
+        void waitIdle(void);
+
+        // Job queue, run from the DMA interrupt
+        SPIJob *volatile _queue_head;
+        SPIJob *_queue_tail;
+        SPIJob *volatile _job_running;
+        // device whose chip select is asserted by a job
+        SPIDevice *volatile _selected;
+        // a blocking transaction owns the bus
+        volatile bool _locked;
+        void runQueue(void);
+        void completeJob(SPIJob *job);
+        void abortQueue(void);
+        static void onJobDone(void *param);
+
+        // transferAsync() callback, called before the queue resumes
+        void (*_async_callback)(void *);
+        void *_async_param;
+        bool startAsync(const void *bufout, void *bufin, uint16_t count, bool wide,
+                        void (*callback)(void *), void *param);
+        static void onAsyncDone(void *param);
 
         SPISettings spisettings;
         bool initialized;
         spi_t         _spi;
 
+        // Peripheral configuration computed for recently used settings, so
+        // switching between a few devices doesn't redo the prescaler search
+        struct CachedSettings {
+            SPISettings settings;
+            spi_parameter_struct params;
+        };
+        CachedSettings _settings_cache[SPI_SETTINGS_CACHE_SIZE];
+        uint8_t _settings_cached;
+        uint8_t _settings_cache_next;
+
 };
 
 extern SPIClass SPI;
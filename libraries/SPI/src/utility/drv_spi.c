@@ -28,6 +28,9 @@ OF SUCH DAMAGE.
 */
 
 #include "drv_spi.h"
+#include "dma.h"
+#include "gpio_interrupt.h"
+#include <string.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -36,6 +39,45 @@ extern "C" {
 #define SPI_S(obj)    (( struct spi_s *)(obj))
 #define SPI_PINS_FREE_MODE   0x00000001
 
+/* DMA transfers are only available on F30x/E50x, see dma.h */
+#if defined(GD32F30x) || defined(GD32E50X)
+typedef struct {
+    uint32_t spi;
+    uint32_t dma;
+    dma_channel_enum tx;
+    dma_channel_enum rx;
+} spi_dma_t;
+
+/* DMA request lines, see the DMA request mapping */
+static const spi_dma_t spi_dma[] = {
+    {SPI0, DMA0, DMA_CH2, DMA_CH1},
+    {SPI1, DMA0, DMA_CH4, DMA_CH3},
+#ifdef SPI2
+    {SPI2, DMA1, DMA_CH1, DMA_CH0},
+#endif
+};
+
+/* source of TX-less transfers and sink of RX-less ones, the DMA doesn't increment over them */
+static uint16_t spi_dma_fill = SPI_FILL_WORD;
+static uint16_t spi_dma_sink;
+
+static const spi_dma_t *spi_dma_get(uint32_t spi)
+{
+    for (size_t i = 0; i < sizeof(spi_dma) / sizeof(spi_dma[0]); i++) {
+        if (spi_dma[i].spi == spi) {
+            return &spi_dma[i];
+        }
+    }
+    return NULL;
+}
+#endif
+
+/* From interrupt context, or with interrupts masked, the DMA interrupt can't end a transfer */
+static inline int spi_can_wait(void)
+{
+    return (0 == __get_IPSR()) && (0 == __get_PRIMASK());
+}
+
 /** Initialize the SPI structure
  *
  * Configures the pins used by SPI, sets a default format and frequency, and enables the peripheral
@@ -50,6 +92,40 @@ static void dev_spi_struct_init(spi_t *obj)
     spi_enable(spiobj->spi);
 }
 
+/** Find the SPI peripheral behind the pins and enable its clock
+ *
+ * @param[in] obj  The SPI object
+ */
+static void dev_spi_periph_init(spi_t *obj)
+{
+    struct spi_s *spiobj = SPI_S(obj);
+
+    /* Determine the SPI to use */
+    SPIName spi_mosi = (SPIName)pinmap_peripheral(spiobj->pin_mosi, PinMap_SPI_MOSI);
+    SPIName spi_miso = (SPIName)pinmap_peripheral(spiobj->pin_miso, PinMap_SPI_MISO);
+    SPIName spi_sclk = (SPIName)pinmap_peripheral(spiobj->pin_sclk, PinMap_SPI_SCLK);
+    SPIName spi_ssel = (SPIName)pinmap_peripheral(spiobj->pin_ssel, PinMap_SPI_SSEL);
+
+    /* return SPIName according to PinName */
+    SPIName spi_data = (SPIName)pinmap_merge(spi_mosi, spi_miso);
+    SPIName spi_cntl = (SPIName)pinmap_merge(spi_sclk, spi_ssel);
+
+    spiobj->spi = (SPIName)pinmap_merge(spi_data, spi_cntl);
+
+    /* enable SPI clock */
+    if (spiobj->spi == SPI0) {
+        rcu_periph_clock_enable(RCU_SPI0);
+    }
+    if (spiobj->spi == SPI1) {
+        rcu_periph_clock_enable(RCU_SPI1);
+    }
+#ifdef SPI2    
+    if (spiobj->spi == SPI2) {
+        rcu_periph_clock_enable(RCU_SPI2);
+    }
+#endif
+}
+
 /** Get the frequency of SPI clock source
  *
  * Configures the pins used by SPI, sets a default format and frequency, and enables the peripheral
@@ -89,38 +165,16 @@ uint32_t dev_spi_clock_source_frequency_get(spi_t *obj)
   * @param  speed : spi output speed
   * @param  mode : one of the spi modes
   * @param  msb : set to 1 in msb first
+  * @param  data_size : SPI_DATA_SIZE_8BIT or SPI_DATA_SIZE_16BIT
   * @retval None
   */
-void spi_begin(spi_t *obj, uint32_t speed, uint8_t mode, uint8_t endian)
+void spi_begin(spi_t *obj, uint32_t speed, uint8_t mode, uint8_t endian, uint8_t data_size)
 {
     struct spi_s *spiobj = SPI_S(obj);
 
-    uint32_t spi_freq = 0;
-
-    /* Determine the SPI to use */
-    SPIName spi_mosi = (SPIName)pinmap_peripheral(spiobj->pin_mosi, PinMap_SPI_MOSI);
-    SPIName spi_miso = (SPIName)pinmap_peripheral(spiobj->pin_miso, PinMap_SPI_MISO);
-    SPIName spi_sclk = (SPIName)pinmap_peripheral(spiobj->pin_sclk, PinMap_SPI_SCLK);
-    SPIName spi_ssel = (SPIName)pinmap_peripheral(spiobj->pin_ssel, PinMap_SPI_SSEL);
-
-    /* return SPIName according to PinName */
-    SPIName spi_data = (SPIName)pinmap_merge(spi_mosi, spi_miso);
-    SPIName spi_cntl = (SPIName)pinmap_merge(spi_sclk, spi_ssel);
-
-    spiobj->spi = (SPIName)pinmap_merge(spi_data, spi_cntl);
-
-    /* enable SPI clock */
-    if (spiobj->spi == SPI0) {
-        rcu_periph_clock_enable(RCU_SPI0);
-    }
-    if (spiobj->spi == SPI1) {
-        rcu_periph_clock_enable(RCU_SPI1);
-    }
-#ifdef SPI2    
-    if (spiobj->spi == SPI2) {
-        rcu_periph_clock_enable(RCU_SPI2);
-    }
-#endif
+    dev_spi_periph_init(obj);
+    spiobj->dma_busy = 0;
+    spiobj->slave = 0;
 
     /* configure GPIO mode of SPI pins */
     pinmap_pinout(spiobj->pin_mosi, PinMap_SPI_MOSI);
@@ -136,55 +190,138 @@ void spi_begin(spi_t *obj, uint32_t speed, uint8_t mode, uint8_t endian)
         spiobj->spi_struct.nss = SPI_NSS_SOFT;
     }
 
-    spi_freq = dev_spi_clock_source_frequency_get(obj);
+    spiobj->spi_freq = dev_spi_clock_source_frequency_get(obj);
+    spi_compute_params(obj, speed, mode, endian, data_size, &spiobj->spi_struct);
+
+    dev_spi_struct_init(obj);
+}
+
+/**
+  * @brief  Compute the peripheral configuration for a set of transfer settings
+  * @param  obj : pointer to spi_t structure, already set up by spi_begin()
+  * @param  speed : spi output speed
+  * @param  mode : one of the spi modes
+  * @param  endian : set to 1 in msb first
+  * @param  data_size : SPI_DATA_SIZE_8BIT or SPI_DATA_SIZE_16BIT
+  * @param  params : filled in with the configuration to pass to spi_apply_params()
+  * @retval None
+  */
+void spi_compute_params(spi_t *obj, uint32_t speed, uint8_t mode, uint8_t endian,
+                        uint8_t data_size, spi_parameter_struct *params)
+{
+    struct spi_s *spiobj = SPI_S(obj);
+    uint32_t spi_freq = spiobj->spi_freq;
+
     if (speed >= (spi_freq / SPI_CLOCK_DIV2)) {
-        spiobj->spi_struct.prescale             = SPI_PSC_2;
+        params->prescale             = SPI_PSC_2;
     } else if (speed >= (spi_freq / SPI_CLOCK_DIV4)) {
-        spiobj->spi_struct.prescale             = SPI_PSC_4;
+        params->prescale             = SPI_PSC_4;
     } else if (speed >= (spi_freq / SPI_CLOCK_DIV8)) {
-        spiobj->spi_struct.prescale             = SPI_PSC_8;
+        params->prescale             = SPI_PSC_8;
     } else if (speed >= (spi_freq / SPI_CLOCK_DIV16)) {
-        spiobj->spi_struct.prescale             = SPI_PSC_16;
+        params->prescale             = SPI_PSC_16;
     } else if (speed >= (spi_freq / SPI_CLOCK_DIV32)) {
-        spiobj->spi_struct.prescale             = SPI_PSC_32;
+        params->prescale             = SPI_PSC_32;
     } else if (speed >= (spi_freq / SPI_CLOCK_DIV64)) {
-        spiobj->spi_struct.prescale             = SPI_PSC_64;
+        params->prescale             = SPI_PSC_64;
     } else if (speed >= (spi_freq / SPI_CLOCK_DIV128)) {
-        spiobj->spi_struct.prescale             = SPI_PSC_128;
+        params->prescale             = SPI_PSC_128;
     } else {
         /*
          * As it is not possible to go below (spi_freq / SPI_SPEED_CLOCK_DIV256_MHZ).
          * Set prescaler at max value so get the lowest frequency possible.
          */
-        spiobj->spi_struct.prescale             = SPI_PSC_256;
+        params->prescale             = SPI_PSC_256;
     }
 
-    if (mode == SPI_MODE0) {
-        spiobj->spi_struct.clock_polarity_phase = SPI_CK_PL_LOW_PH_1EDGE;
-    } else if (mode == SPI_MODE1) {
-        spiobj->spi_struct.clock_polarity_phase = SPI_CK_PL_LOW_PH_2EDGE;
+    if (mode == SPI_MODE1) {
+        params->clock_polarity_phase = SPI_CK_PL_LOW_PH_2EDGE;
     } else if (mode == SPI_MODE2) {
-        spiobj->spi_struct.clock_polarity_phase =  SPI_CK_PL_HIGH_PH_1EDGE;
+        params->clock_polarity_phase = SPI_CK_PL_HIGH_PH_1EDGE;
     } else if (mode == SPI_MODE3) {
-        spiobj->spi_struct.clock_polarity_phase = SPI_CK_PL_HIGH_PH_2EDGE;
+        params->clock_polarity_phase = SPI_CK_PL_HIGH_PH_2EDGE;
     } else {
-        return;
+        params->clock_polarity_phase = SPI_CK_PL_LOW_PH_1EDGE;
     }
 
     if (endian == 0) {
-        spiobj->spi_struct.endian               = SPI_ENDIAN_LSB;
+        params->endian               = SPI_ENDIAN_LSB;
     } else {
-        spiobj->spi_struct.endian               = SPI_ENDIAN_MSB;
+        params->endian               = SPI_ENDIAN_MSB;
     }
 
     /* Default values */
-    spiobj->spi_struct.trans_mode           = SPI_TRANSMODE_FULLDUPLEX;
-    spiobj->spi_struct.device_mode          = SPI_MASTER;
-    spiobj->spi_struct.frame_size           = SPI_FRAMESIZE_8BIT;
+    params->nss                  = spiobj->spi_struct.nss;
+    params->trans_mode           = SPI_TRANSMODE_FULLDUPLEX;
+    params->device_mode          = SPI_MASTER;
+    params->frame_size           = (SPI_DATA_SIZE_16BIT == data_size) ? SPI_FRAMESIZE_16BIT :
+                                   SPI_FRAMESIZE_8BIT;
+}
+
+/**
+  * @brief  Load a configuration computed by spi_compute_params()
+  *
+  * The pins, clocks and peripheral stay as spi_begin() left them, only the
+  * control register is rewritten, and not even that if the configuration
+  * is already loaded.
+  * @param  obj : pointer to spi_t structure
+  * @param  params : configuration to load
+  * @retval None
+  */
+void spi_apply_params(spi_t *obj, const spi_parameter_struct *params)
+{
+    struct spi_s *spiobj = SPI_S(obj);
 
+    if (0 == memcmp(&spiobj->spi_struct, params, sizeof(spi_parameter_struct))) {
+        return;
+    }
+    spiobj->spi_struct = *params;
     dev_spi_struct_init(obj);
 }
 
+#if defined(GD32F30x) || defined(GD32E50X)
+/**
+  * @brief  Stop a DMA transfer and give its channels back
+  * @param  spiobj : pointer to spi_t structure
+  * @param  notify : call the completion callback
+  * @retval None
+  */
+static void spi_dma_end(struct spi_s *spiobj, int notify)
+{
+    const spi_dma_t *dma = spi_dma_get(spiobj->spi);
+
+    spi_dma_disable(spiobj->spi, SPI_DMA_TRANSMIT);
+    spi_dma_disable(spiobj->spi, SPI_DMA_RECEIVE);
+    dma_channel_release(dma->dma, dma->tx);
+    dma_channel_release(dma->dma, dma->rx);
+    /* an aborted transfer may leave a byte and an overrun behind */
+    (void)SPI_DATA(spiobj->spi);
+    (void)SPI_STAT(spiobj->spi);
+    spiobj->dma_busy = 0;
+    if (notify && (NULL != spiobj->dma_callback)) {
+        spiobj->dma_callback(spiobj->dma_callback_param);
+    }
+}
+
+/**
+  * @brief  DMA interrupt callback of both channels of a transfer
+  *
+  * Every byte is received after it has been sent, so the end of the RX
+  * channel is the end of the transfer on the bus.
+  * @param  param : pointer to spi_t structure
+  * @param  events : DMA_EVENT_* that occurred
+  * @retval None
+  */
+static void spi_dma_callback(void *param, uint32_t events)
+{
+    struct spi_s *spiobj = (struct spi_s *)param;
+
+    if (events & (DMA_EVENT_FULL_TRANSFER | DMA_EVENT_ERROR)) {
+        spi_dma_end(spiobj, 1);
+    }
+}
+#endif
+
 /**
   * @brief This function is implemented to deinitialize the SPI interface
   *        (IOs + SPI block)
@@ -194,6 +331,11 @@ void spi_begin(spi_t *obj, uint32_t speed, uint8_t mode, uint8_t endian)
 void spi_free(spi_t *obj)
 {
     struct spi_s *spiobj = SPI_S(obj);
+#if defined(GD32F30x) || defined(GD32E50X)
+    if (spiobj->dma_busy) {
+        spi_dma_end(spiobj, 0);
+    }
+#endif
     spi_disable(spiobj->spi);
 
     /* Disable and deinit SPI */
@@ -228,6 +370,17 @@ void spi_free(spi_t *obj)
   * @retval status of the send operation (0) in case of error
   */
 uint32_t spi_master_write(spi_t *obj, uint8_t value)
+{
+    return spi_master_write16(obj, value);
+}
+
+/**
+  * @brief Send and receive one frame, of either size
+  * @param  obj : pointer to spi_t structure
+  * @param  value : data to be sent
+  * @retval received frame, or 0xFFFFFFFF on timeout
+  */
+uint32_t spi_master_write16(spi_t *obj, uint16_t value)
 {
     int count = 0;
     struct spi_s *spiobj = SPI_S(obj);
@@ -261,10 +414,537 @@ uint32_t spi_master_write(spi_t *obj, uint8_t value)
   */
 void spi_master_block_write(spi_t *obj, uint8_t *tx_buffer, uint8_t *rx_buffer, uint16_t len)
 {
-    for (int i = 0; i < len; i++) {
-        char in = spi_master_write(obj, tx_buffer[i]);
-        rx_buffer[i] = in;
+    spi_master_block_transfer(obj, tx_buffer, rx_buffer, len);
+}
+
+/* Frame i of a block transfer buffer, or the fill frame without one */
+static inline uint16_t spi_frame_get(const uint8_t *buffer, uint32_t i, int wide)
+{
+    if (NULL == buffer) {
+        return wide ? SPI_FILL_WORD : SPI_FILL_BYTE;
+    }
+    return wide ? ((const uint16_t *)buffer)[i] : buffer[i];
+}
+
+/**
+  * @brief  Polled TX-only block transfer
+  *
+  * Frames are written as fast as the transmit buffer takes them and
+  * nothing is read back, the overrun this causes is cleared at the end.
+  * @param  spi : SPI peripheral
+  * @param  tx_buffer : data to send, or NULL to send fill frames
+  * @param  len : number of frames
+  * @param  wide : frames are 16-bit, and so are the buffer elements
+  * @retval None
+  */
+static void spi_master_block_polled_tx(uint32_t spi, const uint8_t *tx_buffer, uint32_t len,
+                                       int wide)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        while (!(SPI_STAT(spi) & SPI_STAT_TBE)) {
+        }
+        SPI_DATA(spi) = spi_frame_get(tx_buffer, i, wide);
+    }
+    /* the last frame is out once the transmit buffer is empty and the shifter idle */
+    while (!(SPI_STAT(spi) & SPI_STAT_TBE)) {
+    }
+    while (SPI_STAT(spi) & SPI_STAT_TRANS) {
+    }
+    (void)SPI_DATA(spi);
+    (void)SPI_STAT(spi);
+}
+
+/**
+  * @brief  Polled block transfer
+  *
+  * The next frame is loaded while the current one is still shifting out, so
+  * SCK runs back to back. The received frame then has to be read before the
+  * next one completes, or the receiver overruns, so interrupts are masked
+  * from loading a frame until the one ahead of it has been read: about one
+  * frame time, use DMA for long transfers at slow clocks.
+  * @param  obj : pointer to spi_t structure
+  * @param  tx_buffer : data to send, or NULL to send SPI_FILL_BYTE
+  * @param  rx_buffer : received data, or NULL to discard it
+  * @param  len : number of frames
+  * @param  wide : frames are 16-bit, and so are the buffer elements
+  * @retval None
+  */
+static void spi_master_block_polled(spi_t *obj, const uint8_t *tx_buffer, uint8_t *rx_buffer,
+                                    uint32_t len, int wide)
+{
+    uint32_t spi = SPI_S(obj)->spi;
+    uint32_t primask;
+
+    if (0 == len) {
+        return;
+    }
+    if (NULL == rx_buffer) {
+        spi_master_block_polled_tx(spi, tx_buffer, len, wide);
+        return;
     }
+
+    /* drop a stale received frame and overrun flag */
+    (void)SPI_DATA(spi);
+    (void)SPI_STAT(spi);
+
+    primask = __get_PRIMASK();
+    while (!(SPI_STAT(spi) & SPI_STAT_TBE)) {
+    }
+    __disable_irq();
+    SPI_DATA(spi) = spi_frame_get(tx_buffer, 0, wide);
+    for (uint32_t i = 0; i < len; i++) {
+        uint16_t in;
+
+        if (i + 1 < len) {
+            /* frame i has moved into the shifter */
+            while (!(SPI_STAT(spi) & SPI_STAT_TBE)) {
+            }
+            SPI_DATA(spi) = spi_frame_get(tx_buffer, i + 1, wide);
+        }
+        while (!(SPI_STAT(spi) & SPI_STAT_RBNE)) {
+        }
+        in = SPI_DATA(spi);
+        /* a pending interrupt gets in while frame i + 1 is shifting */
+        __set_PRIMASK(primask);
+        if (wide) {
+            ((uint16_t *)rx_buffer)[i] = in;
+        } else {
+            rx_buffer[i] = (uint8_t)in;
+        }
+        __disable_irq();
+    }
+    __set_PRIMASK(primask);
+}
+
+/**
+  * @brief  Start a DMA block transfer of 8 or 16-bit frames and return
+  * @param  obj : pointer to spi_t structure
+  * @param  tx_buffer : data to send, or NULL to send fill frames
+  * @param  rx_buffer : received data, or NULL to discard it; may be tx_buffer
+  * @param  len : number of frames
+  * @param  wide : frames are 16-bit, and so are the buffer elements
+  * @param  callback : called from the DMA interrupt once the last frame is in, may be NULL
+  * @param  param : passed back to callback
+  * @retval 1 if the transfer was started, 0 if there is no DMA for this
+  *         SPI, its channels are taken or a transfer is already running
+  */
+static int spi_transfer_dma(spi_t *obj, const uint8_t *tx_buffer, uint8_t *rx_buffer,
+                            uint16_t len, int wide, spi_callback_t callback, void *param)
+{
+#if defined(GD32F30x) || defined(GD32E50X)
+    struct spi_s *spiobj = SPI_S(obj);
+    const spi_dma_t *dma = spi_dma_get(spiobj->spi);
+    dma_parameter_struct dma_init_struct;
+
+    if ((NULL == dma) || (0 == len) || spiobj->dma_busy) {
+        return 0;
+    }
+    if (!dma_channel_claim(dma->dma, dma->rx, spi_dma_callback, spiobj)) {
+        return 0;
+    }
+    if (!dma_channel_claim(dma->dma, dma->tx, spi_dma_callback, spiobj)) {
+        dma_channel_release(dma->dma, dma->rx);
+        return 0;
+    }
+    spiobj->dma_callback = callback;
+    spiobj->dma_callback_param = param;
+    spiobj->dma_busy = 1;
+
+    /* drop a stale received byte and overrun flag */
+    (void)SPI_DATA(spiobj->spi);
+    (void)SPI_STAT(spiobj->spi);
+
+    dma_struct_para_init(&dma_init_struct);
+    dma_init_struct.direction = DMA_PERIPHERAL_TO_MEMORY;
+    dma_init_struct.memory_addr = (NULL != rx_buffer) ? (uint32_t)rx_buffer : (uint32_t)&spi_dma_sink;
+    dma_init_struct.memory_inc = (NULL != rx_buffer) ? DMA_MEMORY_INCREASE_ENABLE : DMA_MEMORY_INCREASE_DISABLE;
+    dma_init_struct.memory_width = wide ? DMA_MEMORY_WIDTH_16BIT : DMA_MEMORY_WIDTH_8BIT;
+    dma_init_struct.number = len;
+    dma_init_struct.periph_addr = (uint32_t)&SPI_DATA(spiobj->spi);
+    dma_init_struct.periph_inc = DMA_PERIPH_INCREASE_DISABLE;
+    dma_init_struct.periph_width = wide ? DMA_PERIPHERAL_WIDTH_16BIT : DMA_PERIPHERAL_WIDTH_8BIT;
+    /* reading has to keep up with writing, or the receiver overruns */
+    dma_init_struct.priority = DMA_PRIORITY_HIGH;
+    dma_channel_start(dma->dma, dma->rx, &dma_init_struct, DMA_EVENT_FULL_TRANSFER | DMA_EVENT_ERROR,
+                      false);
+
+    dma_init_struct.direction = DMA_MEMORY_TO_PERIPHERAL;
+    dma_init_struct.memory_addr = (NULL != tx_buffer) ? (uint32_t)tx_buffer : (uint32_t)&spi_dma_fill;
+    dma_init_struct.memory_inc = (NULL != tx_buffer) ? DMA_MEMORY_INCREASE_ENABLE : DMA_MEMORY_INCREASE_DISABLE;
+    dma_init_struct.priority = DMA_PRIORITY_MEDIUM;
+    dma_channel_start(dma->dma, dma->tx, &dma_init_struct, DMA_EVENT_ERROR, false);
+
+    spi_dma_enable(spiobj->spi, SPI_DMA_RECEIVE);
+    spi_dma_enable(spiobj->spi, SPI_DMA_TRANSMIT);
+    return 1;
+#else
+    (void)obj;
+    (void)tx_buffer;
+    (void)rx_buffer;
+    (void)len;
+    (void)wide;
+    (void)callback;
+    (void)param;
+    return 0;
+#endif
+}
+
+/**
+  * @brief  Blocking block transfer of 8 or 16-bit frames
+  * @param  obj : pointer to spi_t structure
+  * @param  tx_buffer : data to send, or NULL to send fill frames
+  * @param  rx_buffer : received data, or NULL to discard it
+  * @param  len : number of frames
+  * @param  wide : frames are 16-bit, and so are the buffer elements
+  * @retval None
+  */
+static void spi_block_transfer(spi_t *obj, const uint8_t *tx_buffer, uint8_t *rx_buffer,
+                               uint32_t len, int wide)
+{
+    struct spi_s *spiobj = SPI_S(obj);
+    uint32_t step = wide ? 2U : 1U;
+
+    while (len > 0) {
+        uint16_t chunk = (len > 0xFFFFU) ? 0xFFFFU : (uint16_t)len;
+
+        if ((chunk >= SPI_DMA_THRESHOLD) && spi_can_wait() &&
+            spi_transfer_dma(obj, tx_buffer, rx_buffer, chunk, wide, NULL, NULL)) {
+            while (spiobj->dma_busy) {
+            }
+        } else {
+            spi_master_block_polled(obj, tx_buffer, rx_buffer, chunk, wide);
+        }
+        if (NULL != tx_buffer) {
+            tx_buffer += chunk * step;
+        }
+        if (NULL != rx_buffer) {
+            rx_buffer += chunk * step;
+        }
+        len -= chunk;
+    }
+}
+
+/**
+  * @brief  Blocking full-duplex, TX-only or RX-only block transfer
+  *
+  * Runs by DMA when the series supports it, the channels are free and the
+  * transfer is at least SPI_DMA_THRESHOLD bytes long, polled otherwise.
+  * The SPI has to be set up for 8-bit frames.
+  * @param  obj : pointer to spi_t structure
+  * @param  tx_buffer : data to send, or NULL to send SPI_FILL_BYTE
+  * @param  rx_buffer : received data, or NULL to discard it; may be tx_buffer
+  * @param  len : number of bytes
+  * @retval None
+  */
+void spi_master_block_transfer(spi_t *obj, const uint8_t *tx_buffer, uint8_t *rx_buffer,
+                               uint32_t len)
+{
+    spi_block_transfer(obj, tx_buffer, rx_buffer, len, 0);
+}
+
+/**
+  * @brief  spi_master_block_transfer() for 16-bit frames
+  * @param  obj : pointer to spi_t structure, set up for 16-bit frames
+  * @param  tx_buffer : data to send, or NULL to send SPI_FILL_WORD
+  * @param  rx_buffer : received data, or NULL to discard it; may be tx_buffer
+  * @param  len : number of frames
+  * @retval None
+  */
+void spi_master_block_transfer16(spi_t *obj, const uint16_t *tx_buffer, uint16_t *rx_buffer,
+                                 uint32_t len)
+{
+    spi_block_transfer(obj, (const uint8_t *)tx_buffer, (uint8_t *)rx_buffer, len, 1);
+}
+
+/**
+  * @brief  Start a DMA block transfer and return
+  * @param  obj : pointer to spi_t structure, set up for 8-bit frames
+  * @param  tx_buffer : data to send, or NULL to send SPI_FILL_BYTE
+  * @param  rx_buffer : received data, or NULL to discard it; may be tx_buffer
+  * @param  len : number of bytes
+  * @param  callback : called from the DMA interrupt once the last byte is in, may be NULL
+  * @param  param : passed back to callback
+  * @retval 1 if the transfer was started, 0 if there is no DMA for this
+  *         SPI, its channels are taken or a transfer is already running
+  */
+int spi_master_transfer_dma(spi_t *obj, const uint8_t *tx_buffer, uint8_t *rx_buffer, uint16_t len,
+                            spi_callback_t callback, void *param)
+{
+    return spi_transfer_dma(obj, tx_buffer, rx_buffer, len, 0, callback, param);
+}
+
+/**
+  * @brief  spi_master_transfer_dma() for 16-bit frames
+  * @param  obj : pointer to spi_t structure, set up for 16-bit frames
+  * @param  tx_buffer : data to send, or NULL to send SPI_FILL_WORD
+  * @param  rx_buffer : received data, or NULL to discard it; may be tx_buffer
+  * @param  len : number of frames
+  * @param  callback : called from the DMA interrupt once the last frame is in, may be NULL
+  * @param  param : passed back to callback
+  * @retval 1 if the transfer was started, 0 if it couldn't be
+  */
+int spi_master_transfer_dma16(spi_t *obj, const uint16_t *tx_buffer, uint16_t *rx_buffer,
+                              uint16_t len, spi_callback_t callback, void *param)
+{
+    return spi_transfer_dma(obj, (const uint8_t *)tx_buffer, (uint8_t *)rx_buffer, len, 1,
+                            callback, param);
+}
+
+/**
+  * @brief  Whether a DMA transfer is still running
+  * @param  obj : pointer to spi_t structure
+  * @retval 1 until the transfer started by spi_master_transfer_dma() is over
+  */
+int spi_master_busy(spi_t *obj)
+{
+    return SPI_S(obj)->dma_busy;
+}
+
+#if defined(GD32F30x) || defined(GD32E50X)
+/* slave objects by SPI number, for the NSS interrupts */
+static struct spi_s *spi_slave_obj[sizeof(spi_dma) / sizeof(spi_dma[0])];
+
+static int spi_slave_index(uint32_t spi)
+{
+    for (size_t i = 0; i < sizeof(spi_dma) / sizeof(spi_dma[0]); i++) {
+        if (spi_dma[i].spi == spi) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+  * @brief  Configure a pin for slave mode
+  *
+  * These series only drive a pin in alternate function output mode, so
+  * the pins the master drives are turned into plain inputs.
+  * @param  pin : the pin
+  * @param  map : its SPI pin map
+  * @param  input : whether the pin is driven by the master
+  * @retval None
+  */
+static void spi_slave_pinout(PinName pin, const PinMap *map, int input)
+{
+    int function = pinmap_function(pin, map);
+
+    if (input) {
+        function = (function & ~PIN_MODE_MASK) | PIN_MODE_IN_FLOATING;
+    }
+    pin_function(pin, function);
+}
+
+/**
+  * @brief  Arm the peripheral and DMA for the next frame, into slave_half
+  * @param  spiobj : pointer to spi_t structure, with the peripheral just reset
+  * @retval None
+  */
+static void spi_slave_arm(struct spi_s *spiobj)
+{
+    const spi_dma_t *dma = spi_dma_get(spiobj->spi);
+    uint32_t offset = (uint32_t)spiobj->slave_half * spiobj->slave_length;
+    dma_parameter_struct dma_init_struct;
+
+    spi_init(spiobj->spi, &spiobj->spi_struct);
+
+    dma_struct_para_init(&dma_init_struct);
+    dma_init_struct.direction = DMA_PERIPHERAL_TO_MEMORY;
+    dma_init_struct.memory_addr = (NULL != spiobj->slave_rx) ? (uint32_t)&spiobj->slave_rx[offset] :
+                                  (uint32_t)&spi_dma_sink;
+    dma_init_struct.memory_inc = (NULL != spiobj->slave_rx) ? DMA_MEMORY_INCREASE_ENABLE :
+                                 DMA_MEMORY_INCREASE_DISABLE;
+    dma_init_struct.memory_width = DMA_MEMORY_WIDTH_8BIT;
+    dma_init_struct.number = spiobj->slave_length;
+    dma_init_struct.periph_addr = (uint32_t)&SPI_DATA(spiobj->spi);
+    dma_init_struct.periph_inc = DMA_PERIPH_INCREASE_DISABLE;
+    dma_init_struct.periph_width = DMA_PERIPHERAL_WIDTH_8BIT;
+    dma_init_struct.priority = DMA_PRIORITY_ULTRA_HIGH;
+    dma_channel_start(dma->dma, dma->rx, &dma_init_struct, DMA_EVENT_ERROR, false);
+
+    dma_init_struct.direction = DMA_MEMORY_TO_PERIPHERAL;
+    dma_init_struct.memory_addr = (NULL != spiobj->slave_tx) ? (uint32_t)&spiobj->slave_tx[offset] :
+                                  (uint32_t)&spi_dma_fill;
+    dma_init_struct.memory_inc = (NULL != spiobj->slave_tx) ? DMA_MEMORY_INCREASE_ENABLE :
+                                 DMA_MEMORY_INCREASE_DISABLE;
+    dma_init_struct.priority = DMA_PRIORITY_HIGH;
+    dma_channel_start(dma->dma, dma->tx, &dma_init_struct, DMA_EVENT_ERROR, false);
+
+    spi_dma_enable(spiobj->spi, SPI_DMA_RECEIVE);
+    spi_dma_enable(spiobj->spi, SPI_DMA_TRANSMIT);
+    spi_enable(spiobj->spi);
+}
+
+/**
+  * @brief  End of a slave frame, on the rising edge of NSS
+  *
+  * The TX DMA has already loaded bytes the master didn't clock out, and
+  * only a peripheral reset drops them, so the SPI is reset and re-armed
+  * for the other half of the buffers before the frame is reported.
+  * @param  spiobj : pointer to spi_t structure
+  * @retval None
+  */
+static void spi_slave_frame_end(struct spi_s *spiobj)
+{
+    const spi_dma_t *dma = spi_dma_get(spiobj->spi);
+    uint32_t offset = (uint32_t)spiobj->slave_half * spiobj->slave_length;
+    uint16_t count;
+
+    dma_channel_stop(dma->dma, dma->rx);
+    dma_channel_stop(dma->dma, dma->tx);
+    count = spiobj->slave_length - dma_channel_remaining(dma->dma, dma->rx);
+    spi_i2s_deinit(spiobj->spi);
+
+    spiobj->slave_half ^= 1U;
+    spi_slave_arm(spiobj);
+
+    if (NULL != spiobj->slave_callback) {
+        spiobj->slave_callback(spiobj->slave_callback_param,
+                               (NULL != spiobj->slave_rx) ? &spiobj->slave_rx[offset] : NULL, count,
+                               (NULL != spiobj->slave_tx) ? &spiobj->slave_tx[offset] : NULL);
+    }
+}
+
+static void spi_slave_nss_irq0(void)
+{
+    spi_slave_frame_end(spi_slave_obj[0]);
+}
+
+static void spi_slave_nss_irq1(void)
+{
+    spi_slave_frame_end(spi_slave_obj[1]);
+}
+
+#ifdef SPI2
+static void spi_slave_nss_irq2(void)
+{
+    spi_slave_frame_end(spi_slave_obj[2]);
+}
+#endif
+
+static void (*const spi_slave_nss_irq[])(void) = {
+    spi_slave_nss_irq0,
+    spi_slave_nss_irq1,
+#ifdef SPI2
+    spi_slave_nss_irq2,
+#endif
+};
+
+/* the channels only report errors in slave mode, the frame ends on NSS */
+static void spi_slave_dma_callback(void *param, uint32_t events)
+{
+    (void)param;
+    (void)events;
+}
+#endif
+
+/**
+  * @brief  Start slave mode
+  *
+  * NSS has to be wired to the pin_ssel given at construction. Frames are
+  * exchanged by DMA without per-byte interrupts, alternating between the
+  * two halves of the buffers; at the end of each frame the callback gets
+  * the half that was received into and the one that was sent from, which
+  * may be refilled for the frame after next, from the EXTI interrupt. The
+  * master has to leave a few microseconds between frames for the switch.
+  * @param  obj : pointer to spi_t structure
+  * @param  mode : one of the spi modes
+  * @param  endian : set to 1 in msb first
+  * @param  rx_buffers : 2 * length bytes to receive into, or NULL to discard
+  * @param  tx_buffers : 2 * length bytes to send, or NULL to send SPI_FILL_BYTE
+  * @param  length : maximum frame length
+  * @param  callback : called at the end of each frame, may be NULL
+  * @param  param : passed back to callback
+  * @retval 1 if slave mode is running, 0 if there is no DMA or no NSS pin for this SPI
+  */
+int spi_slave_begin(spi_t *obj, uint8_t mode, uint8_t endian, uint8_t *rx_buffers,
+                    uint8_t *tx_buffers, uint16_t length, spi_slave_callback_t callback, void *param)
+{
+#if defined(GD32F30x) || defined(GD32E50X)
+    struct spi_s *spiobj = SPI_S(obj);
+    const spi_dma_t *dma;
+    int index;
+
+    if ((NC == spiobj->pin_ssel) || (0 == length)) {
+        return 0;
+    }
+    dev_spi_periph_init(obj);
+    dma = spi_dma_get(spiobj->spi);
+    index = spi_slave_index(spiobj->spi);
+    if ((NULL == dma) || (index < 0) || (NULL != spi_slave_obj[index])) {
+        return 0;
+    }
+    if (!dma_channel_claim(dma->dma, dma->rx, spi_slave_dma_callback, spiobj)) {
+        return 0;
+    }
+    if (!dma_channel_claim(dma->dma, dma->tx, spi_slave_dma_callback, spiobj)) {
+        dma_channel_release(dma->dma, dma->rx);
+        return 0;
+    }
+
+    spiobj->dma_busy = 0;
+    spiobj->slave = 1;
+    spiobj->slave_half = 0;
+    spiobj->slave_rx = rx_buffers;
+    spiobj->slave_tx = tx_buffers;
+    spiobj->slave_length = length;
+    spiobj->slave_callback = callback;
+    spiobj->slave_callback_param = param;
+    spi_slave_obj[index] = spiobj;
+
+    spi_slave_pinout(spiobj->pin_mosi, PinMap_SPI_MOSI, 1);
+    spi_slave_pinout(spiobj->pin_miso, PinMap_SPI_MISO, 0);
+    spi_slave_pinout(spiobj->pin_sclk, PinMap_SPI_SCLK, 1);
+    spi_slave_pinout(spiobj->pin_ssel, PinMap_SPI_SSEL, 1);
+
+    spiobj->spi_freq = dev_spi_clock_source_frequency_get(obj);
+    spiobj->spi_struct.nss = SPI_NSS_HARD;
+    spi_compute_params(obj, SPI_SPEED_DEFAULT, mode, endian, SPI_DATA_SIZE_8BIT, &spiobj->spi_struct);
+    spiobj->spi_struct.device_mode = SPI_SLAVE;
+
+    spi_i2s_deinit(spiobj->spi);
+    spi_slave_arm(spiobj);
+    /* the EXTI reads the pin whatever its mode, NSS stays an input */
+    gpio_interrupt_enable(GD_PORT_GET(spiobj->pin_ssel), GD_PIN_GET(spiobj->pin_ssel),
+                          spi_slave_nss_irq[index], EXTI_TRIG_RISING);
+    return 1;
+#else
+    (void)obj;
+    (void)mode;
+    (void)endian;
+    (void)rx_buffers;
+    (void)tx_buffers;
+    (void)length;
+    (void)callback;
+    (void)param;
+    return 0;
+#endif
+}
+
+/**
+  * @brief  Stop slave mode and release the peripheral
+  * @param  obj : pointer to spi_t structure
+  * @retval None
+  */
+void spi_slave_end(spi_t *obj)
+{
+#if defined(GD32F30x) || defined(GD32E50X)
+    struct spi_s *spiobj = SPI_S(obj);
+    const spi_dma_t *dma = spi_dma_get(spiobj->spi);
+    int index = spi_slave_index(spiobj->spi);
+
+    if (!spiobj->slave || (NULL == dma) || (index < 0)) {
+        return;
+    }
+    gpio_interrupt_disable(GD_PIN_GET(spiobj->pin_ssel));
+    exti_interrupt_disable((exti_line_enum)BIT(GD_PIN_GET(spiobj->pin_ssel)));
+    dma_channel_release(dma->dma, dma->rx);
+    dma_channel_release(dma->dma, dma->tx);
+    spi_slave_obj[index] = NULL;
+    spiobj->slave = 0;
+    spi_free(obj);
+#else
+    (void)obj;
+#endif
 }
 
 #ifdef __cplusplus
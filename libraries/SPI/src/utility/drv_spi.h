@@ -43,6 +43,10 @@ extern "C" {
 #define SPI_MODE2 2
 #define SPI_MODE3 3
 
+/* Frame sizes */
+#define SPI_DATA_SIZE_8BIT    8
+#define SPI_DATA_SIZE_16BIT   16
+
 /* SPI default speed */
 #define SPI_SPEED_DEFAULT     4000000
 
@@ -55,20 +59,64 @@ extern "C" {
 #define SPI_CLOCK_DIV128  ((uint32_t)128)
 #define SPI_CLOCK_DIV256  ((uint32_t)256)
 
+/* Clocked out by block transfers that have nothing to send */
+#define SPI_FILL_BYTE     0xFF
+#define SPI_FILL_WORD     0xFFFF
+
+/* Blocking block transfers shorter than this are polled even when DMA is available */
+#ifndef SPI_DMA_THRESHOLD
+#define SPI_DMA_THRESHOLD 16
+#endif
+
+typedef void (*spi_callback_t)(void *param);
+/* end of a slave frame: the received half, bytes clocked, the half just sent */
+typedef void (*spi_slave_callback_t)(void *param, uint8_t *rx, uint16_t count, uint8_t *tx);
+
 struct spi_s {
+    /* configuration currently loaded into the peripheral */
     spi_parameter_struct spi_struct;
+    /* SPI clock source frequency, read by spi_begin() */
+    uint32_t spi_freq;
     SPIName spi;
     PinName pin_miso;
     PinName pin_mosi;
     PinName pin_sclk;
     PinName pin_ssel;
+    /* DMA transfer in progress, see spi_master_transfer_dma() */
+    volatile uint8_t dma_busy;
+    spi_callback_t dma_callback;
+    void *dma_callback_param;
+    /* slave mode, see spi_slave_begin() */
+    uint8_t slave;
+    uint8_t slave_half;
+    uint8_t *slave_rx;
+    uint8_t *slave_tx;
+    uint16_t slave_length;
+    spi_slave_callback_t slave_callback;
+    void *slave_callback_param;
 };
 
 typedef struct spi_s spi_t;
 
-void spi_begin(spi_t *obj, uint32_t speed, uint8_t mode, uint8_t endian);
+void spi_begin(spi_t *obj, uint32_t speed, uint8_t mode, uint8_t endian, uint8_t data_size);
+void spi_compute_params(spi_t *obj, uint32_t speed, uint8_t mode, uint8_t endian,
+                        uint8_t data_size, spi_parameter_struct *params);
+void spi_apply_params(spi_t *obj, const spi_parameter_struct *params);
 uint32_t spi_master_write(spi_t *obj, uint8_t value);
+uint32_t spi_master_write16(spi_t *obj, uint16_t value);
 void spi_master_block_write(spi_t *obj, uint8_t *tx_buffer, uint8_t *rx_buffer, uint16_t len);
+void spi_master_block_transfer(spi_t *obj, const uint8_t *tx_buffer, uint8_t *rx_buffer,
+                               uint32_t len);
+int spi_master_transfer_dma(spi_t *obj, const uint8_t *tx_buffer, uint8_t *rx_buffer, uint16_t len,
+                            spi_callback_t callback, void *param);
+void spi_master_block_transfer16(spi_t *obj, const uint16_t *tx_buffer, uint16_t *rx_buffer,
+                                 uint32_t len);
+int spi_master_transfer_dma16(spi_t *obj, const uint16_t *tx_buffer, uint16_t *rx_buffer,
+                              uint16_t len, spi_callback_t callback, void *param);
+int spi_master_busy(spi_t *obj);
+int spi_slave_begin(spi_t *obj, uint8_t mode, uint8_t endian, uint8_t *rx_buffers,
+                    uint8_t *tx_buffers, uint16_t length, spi_slave_callback_t callback, void *param);
+void spi_slave_end(spi_t *obj);
 uint32_t dev_spi_clock_source_frequency_get(spi_t *obj);
 void spi_free(spi_t *obj);
 
@@ -0,0 +1,45 @@
+/*
+  Identify an SPI NOR flash on SPI with CS on pin 10, then log a few
+  records to its first sector and read them back.
+*/
+
+#include <SPIFlash.h>
+
+SPIFlash flash(SPI, 10);
+
+struct Record {
+    uint32_t time;
+    uint32_t value;
+};
+
+void setup()
+{
+    Serial.begin(115200);
+    if (!flash.begin()) {
+        Serial.println("no flash found");
+        return;
+    }
+    Serial.print("JEDEC ID 0x");
+    Serial.println(flash.readJEDECID(), HEX);
+    Serial.print("capacity ");
+    Serial.println(flash.capacity());
+
+    flash.eraseSector(0);
+    for (uint32_t i = 0; i < 64; i++) {
+        Record record = {(uint32_t)millis(), (uint32_t)analogRead(A0)};
+        // returns while the page programs, the next record is taken meanwhile
+        flash.write(i * sizeof(record), &record, sizeof(record));
+    }
+
+    Record records[64];
+    flash.read(0, records, sizeof(records));
+    for (uint32_t i = 0; i < 64; i++) {
+        Serial.print(records[i].time);
+        Serial.print(' ');
+        Serial.println(records[i].value);
+    }
+}
+
+void loop()
+{
+}
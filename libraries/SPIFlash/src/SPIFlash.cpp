@@ -0,0 +1,325 @@
+/*
+ * SPI NOR flash driver
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "SPIFlash.h"
+
+/* 25-series command set */
+#define CMD_WRITE_ENABLE        0x06
+#define CMD_READ_STATUS         0x05
+#define CMD_READ_JEDEC_ID       0x9F
+#define CMD_RELEASE_POWER_DOWN  0xAB
+#define CMD_FAST_READ           0x0B
+#define CMD_FAST_READ_4B        0x0C
+#define CMD_PAGE_PROGRAM        0x02
+#define CMD_PAGE_PROGRAM_4B     0x12
+#define CMD_SECTOR_ERASE        0x20
+#define CMD_SECTOR_ERASE_4B     0x21
+#define CMD_BLOCK32_ERASE       0x52
+#define CMD_BLOCK32_ERASE_4B    0x5C
+#define CMD_BLOCK64_ERASE       0xD8
+#define CMD_BLOCK64_ERASE_4B    0xDC
+#define CMD_CHIP_ERASE          0xC7
+
+#define STATUS_WIP              0x01
+
+/* tRES1, release from deep power-down */
+#define SPIFLASH_WAKEUP_US      30
+
+SPIFlash::SPIFlash(SPIClass &spi, uint8_t csPin, uint32_t clock) :
+    _device(spi, csPin, SPISettings(clock, MSBFIRST, SPI_MODE0)), _capacity(0), _addr4(false),
+    _wip(false), _async_callback(NULL), _async_param(NULL)
+{
+    memset(_jobs, 0, sizeof(_jobs));
+}
+
+/*!
+    \brief      set up the bus, wake the chip and read its size
+    \param[in]  none
+    \param[out] none
+    \retval     false if no flash answers the JEDEC ID command
+*/
+bool SPIFlash::begin(void)
+{
+    _device.bus().begin();
+    _device.begin();
+
+    command(CMD_RELEASE_POWER_DOWN);
+    delayMicroseconds(SPIFLASH_WAKEUP_US);
+
+    uint32_t id = readJEDECID();
+    if ((0 == id) || (0xFFFFFF == id)) {
+        return false;
+    }
+
+    /* the capacity code is log2 of the size in bytes for nearly every vendor */
+    uint8_t code = id & 0xFF;
+    _capacity = ((code >= 0x10) && (code < 0x20)) ? (1UL << code) : 0;
+    _addr4 = (_capacity > 0x1000000);
+    _wip = true;
+    waitReady();
+    return true;
+}
+
+uint32_t SPIFlash::readJEDECID(void)
+{
+    uint8_t id[4] = {CMD_READ_JEDEC_ID, SPI_FILL_BYTE, SPI_FILL_BYTE, SPI_FILL_BYTE};
+
+    waitReady();
+    _device.beginTransaction();
+    _device.bus().transfer(id, sizeof(id));
+    _device.endTransaction();
+    return ((uint32_t)id[1] << 16) | ((uint32_t)id[2] << 8) | id[3];
+}
+
+/* Opcode and address, 4-byte where the part needs it; returns the length */
+uint8_t SPIFlash::header(uint8_t *cmd, uint8_t opcode, uint8_t opcode4, uint32_t address)
+{
+    uint8_t n = 0;
+
+    cmd[n++] = _addr4 ? opcode4 : opcode;
+    if (_addr4) {
+        cmd[n++] = (uint8_t)(address >> 24);
+    }
+    cmd[n++] = (uint8_t)(address >> 16);
+    cmd[n++] = (uint8_t)(address >> 8);
+    cmd[n++] = (uint8_t)address;
+    return n;
+}
+
+void SPIFlash::command(uint8_t opcode)
+{
+    _device.beginTransaction();
+    _device.bus().transfer(opcode);
+    _device.endTransaction();
+}
+
+uint8_t SPIFlash::readStatus(void)
+{
+    uint8_t status;
+
+    _device.beginTransaction();
+    _device.bus().transfer(CMD_READ_STATUS);
+    status = _device.bus().transfer(SPI_FILL_BYTE);
+    _device.endTransaction();
+    return status;
+}
+
+/*!
+    \brief      check once whether a program or erase is still running
+    \param[in]  none
+    \param[out] none
+    \retval     true while the chip is busy
+*/
+bool SPIFlash::busy(void)
+{
+    if (_wip) {
+        _wip = (0 != (readStatus() & STATUS_WIP));
+    }
+    return _wip;
+}
+
+/*!
+    \brief      wait for the program or erase in progress
+    \param[in]  none
+    \param[out] none
+    \retval     none
+*/
+void SPIFlash::waitReady(void)
+{
+    /* one status read per transaction, other devices get the bus in between */
+    while (busy()) {
+        yield();
+    }
+}
+
+/*!
+    \brief      fast read into a buffer
+    \param[in]  address: flash address
+    \param[in]  length: number of bytes
+    \param[out] buffer: data read
+    \retval     none
+*/
+void SPIFlash::read(uint32_t address, void *buffer, size_t length)
+{
+    beginRead(address);
+    readNext(buffer, length);
+    endRead();
+}
+
+void SPIFlash::beginRead(uint32_t address)
+{
+    uint8_t cmd[6];
+    uint8_t n = header(cmd, CMD_FAST_READ, CMD_FAST_READ_4B, address);
+
+    cmd[n++] = SPI_FILL_BYTE;
+    waitReady();
+    _device.beginTransaction();
+    _device.bus().transmit(cmd, n);
+}
+
+void SPIFlash::readNext(void *buffer, size_t length)
+{
+    _device.bus().receive(buffer, length);
+}
+
+void SPIFlash::endRead(void)
+{
+    _device.endTransaction();
+}
+
+/*!
+    \brief      queue a fast read straight into a buffer
+    \param[in]  address: flash address
+    \param[in]  length: number of bytes
+    \param[in]  callback: called from interrupt context when it's in, may be NULL
+    \param[in]  param: passed to callback
+    \param[out] buffer: data read, owned by the read until readDone()
+    \retval     false while the last readAsync() is still running
+*/
+bool SPIFlash::readAsync(uint32_t address, void *buffer, uint16_t length,
+                         void (*callback)(void *), void *param)
+{
+    if ((SPI_JOB_DONE != _jobs[0].status) || (SPI_JOB_DONE != _jobs[1].status)) {
+        return false;
+    }
+    waitReady();
+
+    uint8_t n = header(_async_cmd, CMD_FAST_READ, CMD_FAST_READ_4B, address);
+    _async_cmd[n++] = SPI_FILL_BYTE;
+    _async_callback = callback;
+    _async_param = param;
+
+    /* the two jobs are chained, so the chip select is held across them */
+    _jobs[0].device = &_device;
+    _jobs[0].tx = _async_cmd;
+    _jobs[0].rx = NULL;
+    _jobs[0].length = n;
+    _jobs[0].callback = NULL;
+    _jobs[1].device = &_device;
+    _jobs[1].tx = NULL;
+    _jobs[1].rx = buffer;
+    _jobs[1].length = length;
+    _jobs[1].callback = onReadDone;
+    _jobs[1].param = this;
+    return _device.bus().submit(_jobs, 2);
+}
+
+void SPIFlash::onReadDone(SPIJob *job, void *param)
+{
+    SPIFlash *flash = (SPIFlash *)param;
+
+    (void)job;
+    if (NULL != flash->_async_callback) {
+        flash->_async_callback(flash->_async_param);
+    }
+}
+
+/*!
+    \brief      program up to a page and return while the chip is busy with it
+    \param[in]  address: flash address
+    \param[in]  data: bytes to program, free again on return
+    \param[in]  length: number of bytes, the rest of the page at most
+    \param[out] none
+    \retval     none
+*/
+void SPIFlash::programPage(uint32_t address, const void *data, size_t length)
+{
+    uint8_t cmd[5];
+    uint32_t room = SPIFLASH_PAGE_SIZE - (address & (SPIFLASH_PAGE_SIZE - 1));
+    uint8_t n = header(cmd, CMD_PAGE_PROGRAM, CMD_PAGE_PROGRAM_4B, address);
+
+    /* past the end of the page the chip would wrap around into its start */
+    if (length > room) {
+        length = room;
+    }
+    if (0 == length) {
+        return;
+    }
+    waitReady();
+    command(CMD_WRITE_ENABLE);
+    _device.beginTransaction();
+    _device.bus().transmit(cmd, n);
+    _device.bus().transmit(data, length);
+    _device.endTransaction();
+    _wip = true;
+}
+
+/*!
+    \brief      program a range of any length, page by page
+    \param[in]  address: flash address
+    \param[in]  data: bytes to program, free again on return
+    \param[in]  length: number of bytes
+    \param[out] none
+    \retval     none
+*/
+void SPIFlash::write(uint32_t address, const void *data, size_t length)
+{
+    const uint8_t *src = (const uint8_t *)data;
+
+    /* each page is sent as soon as the last one is programmed; the last
+       one is left programming */
+    while (length) {
+        size_t n = SPIFLASH_PAGE_SIZE - (address & (SPIFLASH_PAGE_SIZE - 1));
+        if (n > length) {
+            n = length;
+        }
+        programPage(address, src, n);
+        address += n;
+        src += n;
+        length -= n;
+    }
+}
+
+void SPIFlash::erase(uint8_t opcode, uint8_t opcode4, uint32_t address)
+{
+    uint8_t cmd[5];
+    uint8_t n = header(cmd, opcode, opcode4, address);
+
+    waitReady();
+    command(CMD_WRITE_ENABLE);
+    _device.beginTransaction();
+    _device.bus().transmit(cmd, n);
+    _device.endTransaction();
+    _wip = true;
+}
+
+/*!
+    \brief      erase the 4 KB sector, 32 KB or 64 KB block holding an address,
+                returning while the chip is busy with it
+    \param[in]  address: any address in it
+    \param[out] none
+    \retval     none
+*/
+void SPIFlash::eraseSector(uint32_t address)
+{
+    erase(CMD_SECTOR_ERASE, CMD_SECTOR_ERASE_4B, address);
+}
+
+void SPIFlash::eraseBlock32(uint32_t address)
+{
+    erase(CMD_BLOCK32_ERASE, CMD_BLOCK32_ERASE_4B, address);
+}
+
+void SPIFlash::eraseBlock64(uint32_t address)
+{
+    erase(CMD_BLOCK64_ERASE, CMD_BLOCK64_ERASE_4B, address);
+}
+
+void SPIFlash::eraseChip(void)
+{
+    waitReady();
+    command(CMD_WRITE_ENABLE);
+    command(CMD_CHIP_ERASE);
+    _wip = true;
+}
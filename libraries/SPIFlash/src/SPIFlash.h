@@ -0,0 +1,105 @@
+/*
+ * SPI NOR flash driver
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#define SPIFLASH_PAGE_SIZE      256
+#define SPIFLASH_SECTOR_SIZE    4096
+#define SPIFLASH_BLOCK32_SIZE   32768
+#define SPIFLASH_BLOCK64_SIZE   65536
+
+/* SCK asked for, the SPI picks the prescaler at or below it */
+#ifndef SPIFLASH_SPI_CLOCK
+#define SPIFLASH_SPI_CLOCK      30000000
+#endif
+
+/*
+ * A 25-series NOR flash on a possibly shared SPI bus, through an SPIDevice.
+ * Parts over 16 MB are driven with the 4-byte address commands.
+ *
+ * Programs and erases return as soon as the command is out: the write in
+ * progress bit is only polled, in short transactions that leave the bus to
+ * other devices, when the next command needs the chip. So the caller can
+ * stage the next page, or get on with anything else, while one programs.
+ */
+class SPIFlash
+{
+    public:
+        SPIFlash(SPIClass &spi, uint8_t csPin, uint32_t clock = SPIFLASH_SPI_CLOCK);
+
+        // Wake the chip and identify it; false if nothing answers
+        bool begin(void);
+
+        // Manufacturer, memory type and capacity bytes, as 0xMMTTCC
+        uint32_t readJEDECID(void);
+        // Bytes, from the JEDEC capacity code; 0 if it isn't a power of two code
+        uint32_t capacity(void) const
+        {
+            return _capacity;
+        }
+
+        // Fast read, by DMA where available once long enough
+        void read(uint32_t address, void *buffer, size_t length);
+        // Fast read queued on the bus, straight into buffer; callback is
+        // called from interrupt context when it's in. False while the last
+        // one is still running.
+        bool readAsync(uint32_t address, void *buffer, uint16_t length,
+                       void (*callback)(void *) = NULL, void *param = NULL);
+        bool readDone(void) const
+        {
+            return SPI_JOB_DONE == _jobs[1].status;
+        }
+        // Streaming read: one fast read command, then as many readNext()
+        // as needed, each continuing where the last one stopped. The bus
+        // stays with the flash until endRead().
+        void beginRead(uint32_t address);
+        void readNext(void *buffer, size_t length);
+        void endRead(void);
+
+        // Program any range, page by page; the area has to be erased
+        void write(uint32_t address, const void *data, size_t length);
+        // Program up to a page, without crossing a page boundary
+        void programPage(uint32_t address, const void *data, size_t length);
+
+        void eraseSector(uint32_t address);
+        void eraseBlock32(uint32_t address);
+        void eraseBlock64(uint32_t address);
+        void eraseChip(void);
+
+        // A program or erase is still running
+        bool busy(void);
+        void waitReady(void);
+
+    private:
+        SPIDevice _device;
+        uint32_t _capacity;
+        bool _addr4;
+        // a program or erase was started and hasn't been seen to finish
+        bool _wip;
+
+        // readAsync(): command header and data phase
+        uint8_t _async_cmd[6];
+        SPIJob _jobs[2];
+        void (*_async_callback)(void *);
+        void *_async_param;
+
+        uint8_t header(uint8_t *cmd, uint8_t opcode, uint8_t opcode4, uint32_t address);
+        void command(uint8_t opcode);
+        void erase(uint8_t opcode, uint8_t opcode4, uint32_t address);
+        uint8_t readStatus(void);
+        static void onReadDone(SPIJob *job, void *param);
+};
@@ -29,9 +29,18 @@ The latest version of this library can always be found at
 http://arduiniana.org.
 */
 #include "SoftwareSerial.h"
+#include "dma.h"
 
 #define OVERSAMPLE 3 // in RX, Timer will generate interruption OVERSAMPLE time during a bit. Thus OVERSAMPLE ticks in a bit. (interrupt not synchonized with edge).
 
+// Frame bits are numbered from the start bit: 0 = start, 1..8 = data,
+// 9 = stop.
+#define FRAME_BITS 10
+
+// Age past which a pending edge-decoded frame is over whatever CYCCNT says:
+// above the longest frame, below the counter's wrap at any core clock
+#define SS_FRAME_STALE_MS 1000
+
 //#define TIMER_SERIAL TIMER1    TIMER1 timer1 is occupied
 
 //Default timer13
@@ -65,16 +74,20 @@ http://arduiniana.org.
 #endif
 
 HardwareTimer SoftwareSerial::timer(TIMER_SERIAL);
-SoftwareSerial *SoftwareSerial::active_listener = nullptr;
-SoftwareSerial *volatile SoftwareSerial::active_out = nullptr;
-SoftwareSerial *volatile SoftwareSerial::active_in = nullptr;
-int32_t SoftwareSerial::tx_tick_cnt = 0; // OVERSAMPLE ticks needed for a bit
-int32_t volatile SoftwareSerial::rx_tick_cnt = 0;  // OVERSAMPLE ticks needed for a bit
-uint32_t SoftwareSerial::tx_buffer = 0;
-int32_t SoftwareSerial::tx_bit_cnt = 0;
-uint32_t SoftwareSerial::rx_buffer = 0;
-int32_t SoftwareSerial::rx_bit_cnt = -1; // rx_bit_cnt = -1 :  waiting for start bit
-uint32_t SoftwareSerial::cur_speed = 0;
+SoftwareSerial *SoftwareSerial::ports[_SS_MAX_PORTS] = {nullptr};
+uint32_t SoftwareSerial::sample_ports[_SS_MAX_PORTS] = {0};
+uint8_t SoftwareSerial::sample_port_cnt = 0;
+uint32_t SoftwareSerial::tick_speed = 0;
+volatile bool SoftwareSerial::timer_running = false;
+#if _SS_EDGE_RX
+SoftwareSerial *SoftwareSerial::edge_ports[16] = {nullptr};
+void (*const SoftwareSerial::edge_handlers[16])(void) = {
+    handleEdge<0>,  handleEdge<1>,  handleEdge<2>,  handleEdge<3>,
+    handleEdge<4>,  handleEdge<5>,  handleEdge<6>,  handleEdge<7>,
+    handleEdge<8>,  handleEdge<9>,  handleEdge<10>, handleEdge<11>,
+    handleEdge<12>, handleEdge<13>, handleEdge<14>, handleEdge<15>
+};
+#endif
 
 SoftwareSerial::SoftwareSerial(uint16_t receivePin, uint16_t transmitPin,
                                bool inverse_logic /* = false */)
@@ -86,17 +99,40 @@ SoftwareSerial::SoftwareSerial(uint16_t receivePin, uint16_t transmitPin,
     _receivePinNumber = gpio_pin[GD_PIN_GET(DIGITAL_TO_PINNAME(receivePin))];
     _transmitPinNumber = gpio_pin[GD_PIN_GET(DIGITAL_TO_PINNAME(transmitPin))];
     _speed = 0;
+    _bit_ticks = 0;
     _buffer_overflow = false;
     _inverse_logic = inverse_logic;
-    _output_pending = 0;
+    _listening = false;
+    _rx_edge = false;
+    _rx_sample = 0;
+    _rx_tick_cnt = 1;
+    _rx_bit_cnt = -1; // _rx_bit_cnt = -1 :  waiting for start bit
+    _rx_buffer = 0;
+    _tx_active = false;
+    _tx_tick_cnt = 0;
+    _tx_bit_cnt = 0;
+    _tx_buffer = 0;
+    _tx_dma_req = false;
+    _tx_dma = -1;
 }
 
-void SoftwareSerial::setSpeed(uint32_t speed)
+// Run the shared tick at OVERSAMPLE times the fastest begun port, and give
+// every port its bit length in ticks. A slower port rounds to the nearest
+// tick, which is exact for the usual multiples of 300 baud. A rate change
+// garbles any byte another port has in flight, so begin() the fastest port
+// before traffic starts.
+void SoftwareSerial::retime()
 {
-    if (speed != cur_speed) {
+    uint32_t speed = 0;
+
+    for (int i = 0; i < _SS_MAX_PORTS; i++) {
+        if (ports[i] && ports[i]->_speed > speed) {
+            speed = ports[i]->_speed;
+        }
+    }
+    if (speed != tick_speed) {
         timer.stop();
         if (speed != 0) {
-            // Disable the timer
             uint32_t clock_rate, cmp_value;
             // Get timer clock
             clock_rate = timer.getTimerClkFre();
@@ -112,81 +148,167 @@ void SoftwareSerial::setSpeed(uint32_t speed)
             timer.setPrescaler(pre);
             timer.setReloadValue(cmp_value);
             timer.setCounter(0);
-
             timer.attachInterrupt(&handleInterrupt);
-            timer.start();
             timer.refresh();
+            if (timer_running) {
+                timer.start();
+            }
         } else {
             timer.detachInterrupt();
+            timer_running = false;
+        }
+        tick_speed = speed;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    for (int i = 0; i < _SS_MAX_PORTS; i++) {
+        if (ports[i]) {
+            ports[i]->_bit_ticks = (speed * OVERSAMPLE + ports[i]->_speed / 2) / ports[i]->_speed;
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+// Collect the GPIO ports of all sampled listeners, so each tick reads every
+// port's input register once however many RX pins are on it. Called with
+// interrupts disabled.
+void SoftwareSerial::regroup()
+{
+    sample_port_cnt = 0;
+    for (int i = 0; i < _SS_MAX_PORTS; i++) {
+        SoftwareSerial *port = ports[i];
+        if (!port || !port->_listening || port->_rx_edge) {
+            continue;
+        }
+        uint8_t j;
+        for (j = 0; j < sample_port_cnt; j++) {
+            if (sample_ports[j] == port->_receivePinPort) {
+                break;
+            }
         }
-        cur_speed = speed;
+        if (j == sample_port_cnt) {
+            sample_ports[sample_port_cnt++] = port->_receivePinPort;
+        }
+        port->_rx_sample = j;
     }
 }
 
-// This function sets the current object as the "listening"
-// one and returns true if it replaces another
+// Called with interrupts disabled; the tick stops itself once no port
+// needs it.
+void SoftwareSerial::startTick()
+{
+    if (!timer_running && tick_speed != 0) {
+        timer_running = true;
+        timer.setCounter(0);
+        timer.start();
+    }
+}
+
+// This function makes the current object receive alongside any other
+// listening ports, and returns true if it wasn't listening yet
 bool SoftwareSerial::listen()
 {
-    if (active_listener != this) {
-        // wait for any transmit to complete as we may change speed
-        while (active_out);
-        active_listener->stopListening();
-        rx_tick_cnt =
-            1; // 1 : next interrupt will decrease rx_tick_cnt to 0 which means RX pin level will be considered.
-        rx_bit_cnt = -1; // rx_bit_cnt = -1 :  waiting for start bit
-        setSpeed(_speed);
-        active_listener = this;
-        active_in = this;
-        return true;
+    if (_listening) {
+        return false;
     }
-    return false;
+    _rx_tick_cnt =
+        1; // 1 : next interrupt will decrease _rx_tick_cnt to 0 which means RX pin level will be considered.
+    _rx_bit_cnt = -1; // _rx_bit_cnt = -1 :  waiting for start bit
+    _rx_edge = false;
+#if _SS_EDGE_RX
+    uint8_t line = GD_PIN_GET(DIGITAL_TO_PINNAME(_receivePin));
+    if (_speed != 0 && !edge_ports[line]) {
+        _rx_level = true;
+        _rx_bit_cycles = SystemCoreClock / _speed;
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+        edge_ports[line] = this;
+        _rx_edge = true;
+        attachInterrupt(_receivePin, edge_handlers[line], CHANGE);
+        // attaching the EXTI line leaves the pin floating
+        pinMode(_receivePin, _inverse_logic ? INPUT_PULLDOWN : INPUT_PULLUP);
+    }
+#endif
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    _listening = true;
+    regroup();
+    if (!_rx_edge) {
+        startTick();
+    }
+    __set_PRIMASK(primask);
+    return true;
 }
 
 // Stop listening. Returns true if we were actually listening.
 bool SoftwareSerial::stopListening()
 {
-    if (active_listener == this) {
-        // wait for any output to complete
-        while (active_out);
-        active_listener = nullptr;
-        active_in = nullptr;
-        // turn off ints
-        setSpeed(0);
-        return true;
+    if (!_listening) {
+        return false;
     }
-    return false;
+#if _SS_EDGE_RX
+    if (_rx_edge) {
+        detachInterrupt(_receivePin);
+        recvTimeout();
+        edge_ports[GD_PIN_GET(DIGITAL_TO_PINNAME(_receivePin))] = nullptr;
+    }
+#endif
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    _listening = false;
+    _rx_edge = false;
+    regroup();
+    __set_PRIMASK(primask);
+    return true;
 }
 
 inline void SoftwareSerial::send()
 {
-    if (--tx_tick_cnt <=
-        0) {  // if tx_tick_cnt > 0 interrupt is discarded. Only when tx_tick_cnt reach 0 we set TX pin.
-        if (tx_bit_cnt++ <
-            10) {  // tx_bit_cnt < 10 transmission is not finished (10 = 1 start +8 bits + 1 stop)
+    if (--_tx_tick_cnt <=
+        0) {  // if _tx_tick_cnt > 0 interrupt is discarded. Only when _tx_tick_cnt reach 0 we set TX pin.
+        if (_tx_bit_cnt++ <
+            10) {  // _tx_bit_cnt < 10 transmission is not finished (10 = 1 start +8 bits + 1 stop)
             // send data (including start and stop bits)
-            if (tx_buffer & 1) {
+            if (_tx_buffer & 1) {
                 gpio_bit_set(_transmitPinPort, _transmitPinNumber);
             } else {
                 gpio_bit_reset(_transmitPinPort, _transmitPinNumber);
             }
-            tx_buffer >>= 1;
-            tx_tick_cnt = OVERSAMPLE; // Wait OVERSAMPLE tick to send next bit
+            _tx_buffer >>= 1;
+            _tx_tick_cnt = _bit_ticks; // Wait a bit to send next bit
         } else { // Transmission finished
-            tx_tick_cnt = 1;
-            if (_output_pending) {
-                active_out = nullptr;
-            }
+            _tx_active = false;
         }
     }
 }
 
-inline void SoftwareSerial::handleInterrupt()
+void SoftwareSerial::handleInterrupt()
 {
-    if (active_in) {
-        active_in->recv();
+    uint32_t levels[_SS_MAX_PORTS];
+    bool busy = false;
+
+    // one input register read per GPIO port, shared by all its RX pins
+    for (uint8_t i = 0; i < sample_port_cnt; i++) {
+        levels[i] = gpio_input_port_get(sample_ports[i]);
     }
-    if (active_out) {
-        active_out->send();
+    for (int i = 0; i < _SS_MAX_PORTS; i++) {
+        SoftwareSerial *port = ports[i];
+        if (!port) {
+            continue;
+        }
+        if (port->_listening && !port->_rx_edge) {
+            port->recv(levels[port->_rx_sample]);
+            busy = true;
+        }
+        if (port->_tx_active) {
+            port->send();
+            busy = true;
+        }
+    }
+    if (!busy) {
+        timer.stop();
+        timer_running = false;
     }
 }
 
@@ -201,6 +323,9 @@ SoftwareSerial::~SoftwareSerial()
 
 void SoftwareSerial::begin(long speed)
 {
+    if (_bit_ticks != 0) {
+        end();
+    }
     _speed = speed;
     if ((_receivePin < DIGITAL_PINS_NUM) || (_transmitPin < DIGITAL_PINS_NUM)) {
         gpio_clock_enable(GD_PORT_GET(DIGITAL_TO_PINNAME(_transmitPin)));
@@ -213,107 +338,452 @@ void SoftwareSerial::begin(long speed)
     }
     pinMode(_transmitPin, OUTPUT);
     pinMode(_receivePin, _inverse_logic ? INPUT_PULLDOWN : INPUT_PULLUP);
-    listen();
+    if (speed <= 0) {
+        return;
+    }
+    for (int i = 0; i < _SS_MAX_PORTS; i++) {
+        if (!ports[i]) {
+            ports[i] = this;
+            retime();
+            listen();
+#if _SS_DMA_TX
+            if (_tx_dma_req) {
+                dmaTxBegin();
+            }
+#endif
+            return;
+        }
+    }
+    // no free slot, raise _SS_MAX_PORTS: the port stays closed, which
+    // operator bool() reports
 }
 
 void SoftwareSerial::end()
 {
     stopListening();
+    // wait for any output to complete
+    while (_tx_active);
+#if _SS_DMA_TX
+    dmaTxEnd();
+#endif
+    for (int i = 0; i < _SS_MAX_PORTS; i++) {
+        if (ports[i] == this) {
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            ports[i] = nullptr;
+            _bit_ticks = 0;
+            __set_PRIMASK(primask);
+            retime();
+        }
+    }
 }
 
 size_t SoftwareSerial::write(uint8_t b)
 {
+#if _SS_DMA_TX
+    if (_tx_dma >= 0) {
+        return dmaTxWrite(b);
+    }
+#endif
+    if (_bit_ticks == 0) {
+        return 0;
+    }
     // wait for previous transmit to complete
-    _output_pending = 1;
-    while (active_out);
+    while (_tx_active);
     // add start and stop bits.
-    tx_buffer = b << 1 | 0x200;
+    _tx_buffer = b << 1 | 0x200;
     if (_inverse_logic) {
-        tx_buffer = ~tx_buffer;
+        _tx_buffer = ~_tx_buffer;
     }
-    tx_bit_cnt = 0;
-    tx_tick_cnt = OVERSAMPLE;
-    setSpeed(_speed);
-    _output_pending = 0;
+    _tx_bit_cnt = 0;
+    _tx_tick_cnt = 1; // start bit on the next tick
     // make us active
-    active_out = this;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    _tx_active = true;
+    startTick();
+    __set_PRIMASK(primask);
     return 1;
 }
 
 // Read data from buffer
 int SoftwareSerial::read()
 {
+    uint8_t c;
+
+#if _SS_EDGE_RX
+    recvTimeout();
+#endif
     // Empty buffer?
-    if (_receive_buffer.head == _receive_buffer.tail) {
+    if (!_receive_buffer.pop(c)) {
         return -1;
-    } else {
-        // Read from "head"
-        uint8_t c = _receive_buffer.buffer[_receive_buffer.head]; // grab next byte
-        _receive_buffer.head = (_receive_buffer.head + 1) % _SS_MAX_RX_BUFF;
-        return c;
     }
+    return c;
 }
 
 int SoftwareSerial::available()
 {
-    return (_receive_buffer.tail + _SS_MAX_RX_BUFF - _receive_buffer.head) % _SS_MAX_RX_BUFF;
+#if _SS_EDGE_RX
+    recvTimeout();
+#endif
+    return _receive_buffer.available();
 }
 
 void SoftwareSerial::flush()
 {
-    noInterrupts();
-    _receive_buffer.head = _receive_buffer.tail = 0;
-    interrupts();
+    // consumer-side discard, safe against a concurrent recv()
+    _receive_buffer.clear();
 }
 
 int SoftwareSerial::peek(void)
 {
-    if (_receive_buffer.head == _receive_buffer.tail) {
+    uint8_t c;
+
+#if _SS_EDGE_RX
+    recvTimeout();
+#endif
+    if (!_receive_buffer.peek(c)) {
         return -1;
-    } else {
-        return _receive_buffer.buffer[_receive_buffer.head];
     }
+    return c;
 }
 
-inline void SoftwareSerial::recv()
+inline void SoftwareSerial::recv(uint32_t levels)
 {
-    if (--rx_tick_cnt <=
-        0) {  // if rx_tick_cnt > 0 interrupt is discarded. Only when rx_tick_cnt reach 0 RX pin is considered
-        bool inbit = gpio_input_bit_get(_receivePinPort, _receivePinNumber) ^ _inverse_logic;
-        if (rx_bit_cnt == -1) {  // rx_bit_cnt = -1 :  waiting for start bit
+    if (--_rx_tick_cnt <=
+        0) {  // if _rx_tick_cnt > 0 interrupt is discarded. Only when _rx_tick_cnt reach 0 RX pin is considered
+        bool inbit = ((levels & _receivePinNumber) != 0) ^ _inverse_logic;
+        if (_rx_bit_cnt == -1) {  // _rx_bit_cnt = -1 :  waiting for start bit
             if (!inbit) {
                 // got start bit
-                rx_bit_cnt = 0; // rx_bit_cnt == 0 : start bit received
-                rx_tick_cnt = OVERSAMPLE +
-                              1; // Wait 1 bit (OVERSAMPLE ticks) + 1 tick in order to sample RX pin in the middle of the edge (and not too close to the edge)
-                rx_buffer = 0;
+                _rx_bit_cnt = 0; // _rx_bit_cnt == 0 : start bit received
+                _rx_tick_cnt = _bit_ticks + _bit_ticks /
+                               2; // Wait 1.5 bit in order to sample RX pin in the middle of the bit (and not too close to the edge)
+                _rx_buffer = 0;
             } else {
-                rx_tick_cnt =
+                _rx_tick_cnt =
                     1; // Waiting for start bit, but we don't get right level. Wait for next Interrupt to check RX pin level
             }
-        } else if (rx_bit_cnt >= 8) { // rx_bit_cnt >= 8 : waiting for stop bit
+        } else if (_rx_bit_cnt >= 8) { // _rx_bit_cnt >= 8 : waiting for stop bit
             if (inbit) {
                 // stop bit read complete add to buffer
-                uint8_t next = (_receive_buffer.tail + 1) % _SS_MAX_RX_BUFF;
-                if (next != _receive_buffer.head) {
-                    // save new data in buffer: tail points to where byte goes
-                    _receive_buffer.buffer[_receive_buffer.tail] = rx_buffer; // save new byte
-                    _receive_buffer.tail = next;
-                } else { // rx_bit_cnt = x  with x = [0..7] correspond to new bit x received
+                if (!_receive_buffer.push(_rx_buffer)) {
                     _buffer_overflow = true;
                 }
             }
             // Full frame received. Restart waiting for start bit at next interrupt
-            rx_tick_cnt = 1;
-            rx_bit_cnt = -1;
+            _rx_tick_cnt = 1;
+            _rx_bit_cnt = -1;
         } else {
-            // data bits
-            rx_buffer >>= 1;
+            // data bits: _rx_bit_cnt = x  with x = [0..7] correspond to new bit x received
+            _rx_buffer >>= 1;
             if (inbit) {
-                rx_buffer |= 0x80;
+                _rx_buffer |= 0x80;
+            }
+            _rx_bit_cnt++; // Prepare for next bit
+            _rx_tick_cnt = _bit_ticks; // Wait a bit before sampling next bit
+        }
+    }
+}
+
+#if _SS_EDGE_RX
+// _rx_buffer collects the frame bits at their positions
+template <uint8_t line>
+void SoftwareSerial::handleEdge()
+{
+    // timestamp first, so the decode doesn't depend on how long we take
+    uint32_t now = DWT->CYCCNT;
+
+    if (edge_ports[line]) {
+        edge_ports[line]->recvEdge(now);
+    }
+}
+
+// Bits [_rx_bit_cnt, upto) were at _rx_level
+inline void SoftwareSerial::recvBits(uint32_t upto)
+{
+    if (upto > FRAME_BITS) {
+        upto = FRAME_BITS;
+    }
+    if (_rx_level) {
+        _rx_buffer |= (1UL << upto) - (1UL << _rx_bit_cnt);
+    }
+    _rx_bit_cnt = upto;
+}
+
+inline void SoftwareSerial::recvFrame()
+{
+    recvBits(FRAME_BITS);
+    if (_rx_buffer & (1UL << (FRAME_BITS - 1))) {
+        // good stop bit, add to buffer
+        if (!_receive_buffer.push((uint8_t)(_rx_buffer >> 1))) {
+            _buffer_overflow = true;
+        }
+    }
+    _rx_bit_cnt = -1; // _rx_bit_cnt = -1 :  waiting for start bit
+}
+
+// Cycles since the start bit. CYCCNT wraps every 2^32 cycles, some 35 s at
+// 120 MHz, which a frame ending in 1 bits can outlast when nothing polls
+// the buffer; a frame that old saturates, from the millisecond count.
+inline uint32_t SoftwareSerial::recvElapsed(uint32_t now)
+{
+    if (millis() - _rx_frame_ms > SS_FRAME_STALE_MS) {
+        return UINT32_MAX;
+    }
+    return now - _rx_frame_start;
+}
+
+inline void SoftwareSerial::recvEdge(uint32_t now)
+{
+    bool level = gpio_input_bit_get(_receivePinPort, _receivePinNumber) ^ _inverse_logic;
+
+    if (_rx_bit_cnt >= 0) {
+        // edges sit on bit boundaries: round to the nearest one
+        uint32_t elapsed = recvElapsed(now);
+        uint32_t pos = (elapsed >= _rx_bit_cycles * FRAME_BITS) ? FRAME_BITS :
+                       (elapsed + _rx_bit_cycles / 2) / _rx_bit_cycles;
+        if (pos == 0) {
+            if (level) {
+                // glitch shorter than half a bit, not a start bit
+                _rx_bit_cnt = -1;
             }
-            rx_bit_cnt++; // Prepare for next bit
-            rx_tick_cnt = OVERSAMPLE; // Wait OVERSAMPLE ticks before sampling next bit
+            return;
+        }
+        recvBits(pos);
+        _rx_level = level;
+        if (pos < FRAME_BITS) {
+            return;
         }
+        // this edge is past the stop bit: the frame is complete, and a
+        // falling edge here is already the next start bit
+        recvFrame();
+    }
+    if (!level) {
+        // got start bit
+        _rx_frame_start = now;
+        _rx_frame_ms = millis();
+        _rx_buffer = 0;
+        _rx_bit_cnt = 0;
+        _rx_level = false;
+    }
+}
+
+// A frame that ends with 1 bits has no edge after its last data bit. It's
+// finished here once the middle of its stop bit has passed, whenever the
+// buffer is looked at, rather than by a timer interrupt.
+void SoftwareSerial::recvTimeout()
+{
+    if (!_rx_edge) {
+        return;
     }
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if ((_rx_bit_cnt >= 0) &&
+        (recvElapsed(DWT->CYCCNT) >= _rx_bit_cycles * (2 * FRAME_BITS - 1) / 2)) {
+        recvFrame();
+    }
+    __set_PRIMASK(primask);
 }
+#endif
+
+#if _SS_DMA_TX
+typedef struct {
+    uint32_t timer;
+    uint32_t dma;
+    dma_channel_enum channel;
+} dma_tx_hw_t;
+
+// Timers whose update event can request DMA, with the channel it's routed
+// to. Timers the variant reserves for tone(), Servo or the tick are
+// skipped; while a port transmits through one of the others, PWM can't be
+// used on it.
+static const dma_tx_hw_t dma_tx_hw[] = {
+    {TIMER7, DMA1, DMA_CH0},
+    {TIMER4, DMA1, DMA_CH1},
+    {TIMER5, DMA1, DMA_CH2},
+    {TIMER6, DMA1, DMA_CH3},
+};
+
+#define DMA_TX_WORDS (_SS_DMA_TX_FRAMES * FRAME_BITS)
+
+typedef struct {
+    const dma_tx_hw_t *hw;               // NULL while free
+    uint32_t bop;                        // address of the TX port's BOP register
+    uint32_t wave[2][DMA_TX_WORDS];      // BOP words, one per bit
+    volatile uint16_t len[2];
+    volatile uint8_t fill;               // block write() renders into
+    volatile bool busy;                  // a block is being clocked out
+} dma_tx_engine_t;
+
+static dma_tx_engine_t dma_tx_engine[_SS_DMA_TX_PORTS];
+
+static bool dma_tx_reserved(uint32_t timer)
+{
+#if defined(TIMER_TONE)
+    if (timer == (uint32_t)TIMER_TONE) {
+        return true;
+    }
+#endif
+#if defined(TIMER_SERVO)
+    if (timer == (uint32_t)TIMER_SERVO) {
+        return true;
+    }
+#endif
+    if (timer == (uint32_t)TIMER_SERIAL) {
+        return true;
+    }
+    for (int i = 0; i < _SS_DMA_TX_PORTS; i++) {
+        if (dma_tx_engine[i].hw && dma_tx_engine[i].hw->timer == timer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Claim a free engine and a timer/DMA pair and run the timer at the bit rate
+bool SoftwareSerial::dmaTxBegin()
+{
+    dma_tx_engine_t *engine = nullptr;
+    int index;
+
+    for (index = 0; index < _SS_DMA_TX_PORTS; index++) {
+        if (!dma_tx_engine[index].hw) {
+            engine = &dma_tx_engine[index];
+            break;
+        }
+    }
+    if (!engine) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(dma_tx_hw) / sizeof(dma_tx_hw[0]); i++) {
+        const dma_tx_hw_t *hw = &dma_tx_hw[i];
+        if (dma_tx_reserved(hw->timer) ||
+            !dma_channel_claim(hw->dma, hw->channel, dmaTxDone, engine)) {
+            continue;
+        }
+        engine->hw = hw;
+        engine->bop = (uint32_t)&GPIO_BOP(_transmitPinPort);
+        engine->len[0] = 0;
+        engine->len[1] = 0;
+        engine->fill = 0;
+        engine->busy = false;
+
+        uint32_t clock_rate = getTimerClkFrequency(hw->timer);
+        uint32_t pre = 1;
+        while (clock_rate / (pre * _speed) > UINT16_MAX) {
+            pre *= 2;
+        }
+        timer_parameter_struct timer_initpara;
+        timer_clock_enable(hw->timer);
+        timer_deinit(hw->timer);
+        timer_struct_para_init(&timer_initpara);
+        timer_initpara.prescaler = pre - 1;
+        timer_initpara.alignedmode = TIMER_COUNTER_EDGE;
+        timer_initpara.counterdirection = TIMER_COUNTER_UP;
+        timer_initpara.period = clock_rate / (pre * _speed) - 1;
+        timer_initpara.clockdivision = TIMER_CKDIV_DIV1;
+        timer_initpara.repetitioncounter = 0;
+        timer_init(hw->timer, &timer_initpara);
+
+        _tx_dma = index;
+        return true;
+    }
+    return false;
+}
+
+void SoftwareSerial::dmaTxEnd()
+{
+    if (_tx_dma < 0) {
+        return;
+    }
+    dma_tx_engine_t *engine = &dma_tx_engine[_tx_dma];
+    while (engine->busy);
+    // the DMA is done as the stop bit starts: let it finish
+    delayMicroseconds(1000000 / _speed + 1);
+    timer_disable(engine->hw->timer);
+    timer_dma_disable(engine->hw->timer, TIMER_DMA_UPD);
+    dma_channel_release(engine->hw->dma, engine->hw->channel);
+    engine->hw = nullptr;
+    _tx_dma = -1;
+}
+
+// Clock out the block write() has been rendering into, called with
+// interrupts disabled. The timer restarts from zero so the first word (a
+// start bit) goes out a full bit after the previous stop bit began.
+void SoftwareSerial::dmaTxStart(void *param)
+{
+    dma_tx_engine_t *engine = (dma_tx_engine_t *)param;
+    const dma_tx_hw_t *hw = engine->hw;
+    uint8_t block = engine->fill;
+    dma_parameter_struct dma_init_struct;
+
+    timer_disable(hw->timer);
+    timer_dma_disable(hw->timer, TIMER_DMA_UPD);
+    timer_counter_value_config(hw->timer, 0);
+
+    dma_struct_para_init(&dma_init_struct);
+    dma_init_struct.direction = DMA_MEMORY_TO_PERIPHERAL;
+    dma_init_struct.memory_addr = (uint32_t)engine->wave[block];
+    dma_init_struct.memory_inc = DMA_MEMORY_INCREASE_ENABLE;
+    dma_init_struct.memory_width = DMA_MEMORY_WIDTH_32BIT;
+    dma_init_struct.number = engine->len[block];
+    dma_init_struct.periph_addr = engine->bop;
+    dma_init_struct.periph_inc = DMA_PERIPH_INCREASE_DISABLE;
+    dma_init_struct.periph_width = DMA_PERIPHERAL_WIDTH_32BIT;
+    dma_init_struct.priority = DMA_PRIORITY_HIGH;
+    dma_channel_start(hw->dma, hw->channel, &dma_init_struct, DMA_EVENT_FULL_TRANSFER, false);
+
+    timer_dma_enable(hw->timer, TIMER_DMA_UPD);
+    timer_enable(hw->timer);
+
+    engine->fill = block ^ 1;
+    engine->len[engine->fill] = 0;
+    engine->busy = true;
+}
+
+void SoftwareSerial::dmaTxDone(void *param, uint32_t events)
+{
+    dma_tx_engine_t *engine = (dma_tx_engine_t *)param;
+
+    (void)events;
+    if (engine->len[engine->fill] != 0) {
+        dmaTxStart(engine);
+    } else {
+        timer_disable(engine->hw->timer);
+        engine->busy = false;
+    }
+}
+
+// Render the frame straight into set/reset words for the TX pin; only
+// waits when both blocks are full.
+size_t SoftwareSerial::dmaTxWrite(uint8_t b)
+{
+    dma_tx_engine_t *engine = &dma_tx_engine[_tx_dma];
+    uint32_t frame = b << 1 | 0x200;
+    uint32_t primask;
+
+    if (_inverse_logic) {
+        frame = ~frame;
+    }
+    for (;;) {
+        primask = __get_PRIMASK();
+        __disable_irq();
+        if (engine->len[engine->fill] + FRAME_BITS <= DMA_TX_WORDS) {
+            break;
+        }
+        __set_PRIMASK(primask);
+    }
+    uint32_t *word = &engine->wave[engine->fill][engine->len[engine->fill]];
+    for (int i = 0; i < FRAME_BITS; i++) {
+        word[i] = (frame & 1) ? _transmitPinNumber : (_transmitPinNumber << 16);
+        frame >>= 1;
+    }
+    engine->len[engine->fill] += FRAME_BITS;
+    if (!engine->busy) {
+        dmaTxStart(engine);
+    }
+    __set_PRIMASK(primask);
+    return 1;
+}
+#endif
@@ -40,18 +40,54 @@
 //}
 #include <Arduino.h>
 #include <Stream.h>
+#include "SPSCRingBuffer.h"
 /******************************************************************************
 * Definitions
 ******************************************************************************/
 #ifndef _SS_MAX_RX_BUFF
-#define _SS_MAX_RX_BUFF 64 // RX buffer size
+#define _SS_MAX_RX_BUFF 64 // RX buffer size, rounded down to a power of 2
 #endif
 
-typedef struct {
-    unsigned char buffer[_SS_MAX_RX_BUFF];
-    volatile uint8_t head;
-    volatile uint8_t tail;
-} receive_buffer;
+// Number of ports that can be begun at the same time. They all share one
+// timer tick, running at OVERSAMPLE times the fastest port's speed. A port
+// begun while all are in use stays closed, see operator bool().
+#ifndef _SS_MAX_PORTS
+#define _SS_MAX_PORTS 4
+#endif
+#if (_SS_MAX_PORTS < 1) || (_SS_MAX_PORTS > 255)
+#error "_SS_MAX_PORTS must be between 1 and 255"
+#endif
+
+// Receive by timestamping the RX pin's edges (EXTI on both edges, read
+// against the DWT cycle counter) and decoding frames from the edge times,
+// instead of sampling the pin OVERSAMPLE times per bit from the timer. The
+// timer then only runs while a byte is being sent. Parts without a cycle
+// counter (Cortex-M23) keep the sampling receiver, as does defining
+// _SS_SAMPLED_RX. A port whose RX pin shares its EXTI line (pin number)
+// with another listening port is sampled too.
+#if !defined(_SS_SAMPLED_RX) && defined(DWT_CTRL_CYCCNTENA_Msk)
+#define _SS_EDGE_RX 1
+#else
+#define _SS_EDGE_RX 0
+#endif
+
+// Transmit by clocking pre-rendered frames out to the TX pin's port with a
+// timer-triggered DMA channel (see setDmaTx()). Needs the basic/advanced
+// timers and the second DMA controller of the F30x high-density parts.
+#if defined(GD32F30X_HD) || defined(GD32F30X_XD) || defined(GD32F30X_CL)
+#define _SS_DMA_TX 1
+#else
+#define _SS_DMA_TX 0
+#endif
+
+// Frames each of a DMA port's two render buffers holds, and how many ports
+// can transmit by DMA at the same time
+#ifndef _SS_DMA_TX_FRAMES
+#define _SS_DMA_TX_FRAMES 8
+#endif
+#ifndef _SS_DMA_TX_PORTS
+#define _SS_DMA_TX_PORTS 2
+#endif
 
 class SoftwareSerial : public Stream
 {
@@ -64,48 +100,94 @@ class SoftwareSerial : public Stream
         uint32_t _transmitPinPort;
         uint32_t _transmitPinNumber;
         uint32_t _speed;
+        int32_t _bit_ticks;       // timer ticks in a bit, 0 while not begun
 
         uint16_t _buffer_overflow: 1;
         uint16_t _inverse_logic: 1;
-        uint16_t _output_pending: 1;
+        uint16_t _listening: 1;
+        uint16_t _rx_edge: 1;      // RX decoded from edges rather than sampled
+        uint16_t _tx_dma_req: 1;   // setDmaTx() asked for DMA transmit
+        int8_t _tx_dma;           // DMA transmit engine in use, -1 for the tick
+        uint8_t _rx_sample;       // index of _receivePinPort in sample_ports
+
+        // receive state
+        int32_t _rx_tick_cnt;
+        int32_t _rx_bit_cnt;
+        uint32_t _rx_buffer;
+#if _SS_EDGE_RX
+        uint32_t _rx_frame_start; // cycle count of the start bit's falling edge
+        uint32_t _rx_frame_ms;    // millis() then, for frames older than a CYCCNT wrap
+        uint32_t _rx_bit_cycles;  // cycles per bit
+        bool _rx_level;           // line level since the last edge
+#endif
 
-        receive_buffer _receive_buffer;
+        // transmit state
+        volatile bool _tx_active;
+        int32_t _tx_tick_cnt;
+        int32_t _tx_bit_cnt;
+        uint32_t _tx_buffer;
 
-        //unsigned char _receive_buffer[_SS_MAX_RX_BUFF];
-        //volatile uint8_t _receive_buffer_tail;
-        //volatile uint8_t _receive_buffer_head;
+        // filled by the timer or EXTI interrupt, drained by read()
+        SPSCRingBufferN<uint8_t, _SS_MAX_RX_BUFF> _receive_buffer;
 
         // static data
         static HardwareTimer timer;
-        static SoftwareSerial *active_listener;
-        static SoftwareSerial *volatile active_out;
-        static SoftwareSerial *volatile active_in;
-        static int32_t tx_tick_cnt;
-        static volatile int32_t rx_tick_cnt;
-        static uint32_t tx_buffer;
-        static int32_t tx_bit_cnt;
-        static uint32_t rx_buffer;
-        static int32_t rx_bit_cnt;
-        static uint32_t cur_speed;
+        static SoftwareSerial *ports[_SS_MAX_PORTS];        // begun ports
+        static uint32_t sample_ports[_SS_MAX_PORTS];        // GPIO ports read on each tick
+        static uint8_t sample_port_cnt;
+        static uint32_t tick_speed;                         // speed the tick oversamples
+        static volatile bool timer_running;
+#if _SS_EDGE_RX
+        static SoftwareSerial *edge_ports[16];              // listener on each EXTI line
+        static void (*const edge_handlers[16])(void);
+#endif
 
         // private methods
         void send();
-        void recv();
-        void setSpeed(uint32_t speed);
+        void recv(uint32_t levels);
+        static void retime();
+        static void regroup();
+        static void startTick();
         static void handleInterrupt();
+#if _SS_EDGE_RX
+        uint32_t recvElapsed(uint32_t now);
+        void recvEdge(uint32_t now);
+        void recvBits(uint32_t upto);
+        void recvFrame();
+        void recvTimeout();
+        template <uint8_t line> static void handleEdge();
+#endif
+#if _SS_DMA_TX
+        bool dmaTxBegin();
+        void dmaTxEnd();
+        size_t dmaTxWrite(uint8_t b);
+        static void dmaTxStart(void *engine);
+        static void dmaTxDone(void *engine, uint32_t events);
+#endif
 
     public:
         // public methods
         SoftwareSerial(uint16_t receivePin, uint16_t transmitPin, bool inverse_logic = false);
         virtual ~SoftwareSerial();
         void begin(long speed);
+        // Every begun port can listen at the same time; listen() only
+        // returns false if this one already was.
         bool listen();
         void end();
         bool isListening()
         {
-            return active_listener == this;
+            return _listening;
         }
         bool stopListening();
+        // Render each frame into GPIO bit set/reset words and have a timer
+        // DMA them to the TX pin's port, instead of setting the pin from the
+        // tick: exact bit timing and no interrupt per bit. Applied by the
+        // next begin(); falls back to the tick when no timer/DMA channel
+        // pair is free.
+        void setDmaTx(bool enable)
+        {
+            _tx_dma_req = enable;
+        }
         bool overflow()
         {
             bool ret = _buffer_overflow;
@@ -120,9 +202,12 @@ class SoftwareSerial : public Stream
         virtual int read();
         virtual int available();
         virtual void flush();
+        // False until begin() succeeds: also after begin() found all
+        // _SS_MAX_PORTS ports in use, in which case write() sends nothing
+        // and nothing is received
         operator bool()
         {
-            return true;
+            return _bit_ticks != 0;
         }
 
         //static void setInterruptPriority(uint32_t preemptPriority, uint32_t subPriority);
@@ -0,0 +1,32 @@
+// Rainbow on a strip of WS2812 LEDs, with DIN wired to MOSI
+#include <WS2812.h>
+
+#define NUM_LEDS 64
+
+WS2812N<NUM_LEDS> strip(SPI);
+
+void setup()
+{
+    strip.begin();
+}
+
+void loop()
+{
+    static uint8_t offset = 0;
+
+    for (uint16_t i = 0; i < strip.numPixels(); i++) {
+        uint8_t hue = offset + i * 256 / NUM_LEDS;
+        uint8_t phase = (hue % 85) * 3;
+        if (hue < 85) {
+            strip.setPixelColor(i, 255 - phase, phase, 0);
+        } else if (hue < 170) {
+            strip.setPixelColor(i, 0, 255 - phase, phase);
+        } else {
+            strip.setPixelColor(i, phase, 0, 255 - phase);
+        }
+    }
+    // returns straight away, the frame goes out by DMA
+    strip.show();
+    offset++;
+    delay(20);
+}
@@ -0,0 +1,200 @@
+/*
+ * WS2812/SK6812 addressable LED driver over SPI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#include "WS2812.h"
+
+/* SPI byte for two LED bits, MSB first */
+static const uint8_t ws2812_bit_pairs[4] = {0x88, 0x8E, 0xE8, 0xEE};
+
+static const SPISettings ws2812_settings(WS2812_SPI_CLOCK, MSBFIRST, SPI_MODE0);
+
+WS2812::WS2812(SPIClass &spi, uint16_t count, uint8_t bytesPerPixel, uint8_t *pixels,
+               uint8_t *frames) :
+    _spi(spi), _device(spi, SPI_CS_PIN_NONE, SPISettings(WS2812_SPI_CLOCK, MSBFIRST, SPI_MODE0)),
+    _count(count), _bpp(bytesPerPixel), _pixels(pixels),
+    _frame_size(WS2812_FRAME_SIZE(count, bytesPerPixel)), _sending(-1), _queued(false),
+    _queued_index(0)
+{
+    _frames[0] = frames;
+    _frames[1] = frames + _frame_size;
+    memset(&_job, 0, sizeof(_job));
+}
+
+/*!
+    \brief      set up the SPI and turn all pixels off on the next show()
+    \param[in]  none
+    \param[out] none
+    \retval     none
+*/
+void WS2812::begin(void)
+{
+    _spi.begin();
+    _device.begin();
+    /* the latch time at the end of each frame is never encoded over */
+    memset(_frames[0], 0, 2 * _frame_size);
+    clear();
+}
+
+/*!
+    \brief      wait for the frames in flight
+    \param[in]  none
+    \param[out] none
+    \retval     none
+*/
+void WS2812::end(void)
+{
+    while (busy()) {
+    }
+}
+
+/*!
+    \brief      set a pixel of the staging buffer
+    \param[in]  n: pixel index
+    \param[in]  r, g, b: colour
+    \param[in]  w: white, for 4 byte per pixel parts
+    \param[out] none
+    \retval     none
+*/
+void WS2812::setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b, uint8_t w)
+{
+    if (n >= _count) {
+        return;
+    }
+    uint8_t *p = &_pixels[n * _bpp];
+    p[0] = g;
+    p[1] = r;
+    p[2] = b;
+    if (_bpp > 3) {
+        p[3] = w;
+    }
+}
+
+void WS2812::setPixelColor(uint16_t n, uint32_t color)
+{
+    setPixelColor(n, (uint8_t)(color >> 16), (uint8_t)(color >> 8), (uint8_t)color,
+                  (uint8_t)(color >> 24));
+}
+
+/*!
+    \brief      read a pixel back from the staging buffer
+    \param[in]  n: pixel index
+    \param[out] none
+    \retval     colour as 0xWWRRGGBB
+*/
+uint32_t WS2812::getPixelColor(uint16_t n) const
+{
+    if (n >= _count) {
+        return 0;
+    }
+    const uint8_t *p = &_pixels[n * _bpp];
+    uint32_t color = ((uint32_t)p[1] << 16) | ((uint32_t)p[0] << 8) | p[2];
+    if (_bpp > 3) {
+        color |= (uint32_t)p[3] << 24;
+    }
+    return color;
+}
+
+void WS2812::clear(void)
+{
+    memset(_pixels, 0, (size_t)_count * _bpp);
+}
+
+/* Four SPI bytes per pixel byte, the latch time after them stays zero */
+void WS2812::encode(uint8_t *frame)
+{
+    const uint8_t *p = _pixels;
+    const uint8_t *end = _pixels + (size_t)_count * _bpp;
+
+    while (p < end) {
+        uint8_t value = *p++;
+        frame[0] = ws2812_bit_pairs[value >> 6];
+        frame[1] = ws2812_bit_pairs[(value >> 4) & 3];
+        frame[2] = ws2812_bit_pairs[(value >> 2) & 3];
+        frame[3] = ws2812_bit_pairs[value & 3];
+        frame += 4;
+    }
+}
+
+/*!
+    \brief      encode the staging buffer and send it in the background
+    \param[in]  none
+    \param[out] none
+    \retval     none
+*/
+void WS2812::show(void)
+{
+    uint8_t index;
+    bool start;
+    uint32_t primask = __get_PRIMASK();
+
+    /* take the buffer that isn't on the wire, dropping a frame waiting in it */
+    __disable_irq();
+    index = (_sending == 0) ? 1 : 0;
+    _queued = false;
+    __set_PRIMASK(primask);
+
+    encode(_frames[index]);
+
+    __disable_irq();
+    start = (_sending < 0);
+    if (!start) {
+        _queued_index = index;
+        _queued = true;
+    }
+    __set_PRIMASK(primask);
+
+    if (start) {
+        startFrame(index);
+    }
+}
+
+/*
+ * Queue a frame on the SPI, from show() or the completion interrupt. A frame
+ * too long for a job can only come from show(), and is sent blocking.
+ */
+void WS2812::startFrame(uint8_t index)
+{
+    _sending = index;
+    if (_frame_size > 0xFFFF) {
+        _spi.beginTransaction(ws2812_settings);
+        _spi.transmit(_frames[index], _frame_size);
+        _spi.endTransaction();
+        _sending = -1;
+        return;
+    }
+    _job.device = &_device;
+    _job.tx = _frames[index];
+    _job.rx = NULL;
+    _job.length = (uint16_t)_frame_size;
+    _job.callback = onFrameSent;
+    _job.param = this;
+    if (!_spi.submit(&_job)) {
+        /* the SPI isn't begun, or was ended */
+        _sending = -1;
+    }
+}
+
+/* Job completion, the next frame follows straight away */
+void WS2812::onFrameSent(SPIJob *job, void *param)
+{
+    WS2812 *strip = (WS2812 *)param;
+
+    strip->_sending = -1;
+    if (job->aborted) {
+        strip->_queued = false;
+    } else if (strip->_queued) {
+        strip->_queued = false;
+        strip->startFrame(strip->_queued_index);
+    }
+}
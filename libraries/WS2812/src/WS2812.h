@@ -0,0 +1,121 @@
+/*
+ * WS2812/SK6812 addressable LED driver over SPI
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <SPI.h>
+
+/*
+ * Each LED bit goes out as four SPI bits, 1000 for a 0 and 1110 for a 1, so
+ * SCK has to come out at about 3-4.5 MHz: the prescaler of the SPI's APB
+ * clock at or below this rate is used. Every bit pattern ends low, which
+ * is also the level MOSI is left at between frames.
+ */
+#ifndef WS2812_SPI_CLOCK
+#define WS2812_SPI_CLOCK 3750000
+#endif
+
+/* Low time after a frame that latches it, enough for WS2812B and SK6812 */
+#ifndef WS2812_LATCH_US
+#define WS2812_LATCH_US 300
+#endif
+
+#define WS2812_LATCH_BYTES  ((WS2812_LATCH_US * (WS2812_SPI_CLOCK / 1000)) / 8000 + 1)
+
+/* Bytes of one encoded frame, two of which make up the frames buffer */
+#define WS2812_FRAME_SIZE(count, bytesPerPixel) ((count) * (bytesPerPixel) * 4 + WS2812_LATCH_BYTES)
+
+/*
+ * The pixels are staged in wire order (G, R, B and W for RGBW parts) and
+ * only encoded by show(), into whichever of the two frame buffers isn't on
+ * the wire. Each frame goes out as a job on the SPI's queue, by DMA in the
+ * background where available, so it waits for transactions of other code
+ * and the next frame follows from the completion interrupt. The strip has
+ * no chip select, so MOSI should still only reach the LEDs.
+ */
+class WS2812
+{
+    public:
+        // pixels holds count * bytesPerPixel bytes, frames
+        // 2 * WS2812_FRAME_SIZE(count, bytesPerPixel); see WS2812N for a
+        // strip with its own storage
+        WS2812(SPIClass &spi, uint16_t count, uint8_t bytesPerPixel, uint8_t *pixels,
+               uint8_t *frames);
+
+        void begin(void);
+        // waits for the frames in flight
+        void end(void);
+
+        uint16_t numPixels(void) const
+        {
+            return _count;
+        }
+        void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b, uint8_t w = 0);
+        // 0xWWRRGGBB
+        void setPixelColor(uint16_t n, uint32_t color);
+        uint32_t getPixelColor(uint16_t n) const;
+        uint8_t *getPixels(void)
+        {
+            return _pixels;
+        }
+        void clear(void);
+
+        // Encode the pixels and send them without waiting. A frame still
+        // on the wire is finished first; a frame that was waiting for it is
+        // replaced. The pixels may be changed again as soon as it returns.
+        // Frames over 65535 bytes, about 5400 RGB pixels, are sent blocking.
+        void show(void);
+        // No frame is waiting behind the one on the wire
+        bool canShow(void) const
+        {
+            return !_queued;
+        }
+        // A frame is on the wire or waiting
+        bool busy(void) const
+        {
+            return (_sending >= 0) || _queued;
+        }
+
+    private:
+        SPIClass &_spi;
+        SPIDevice _device;
+        SPIJob _job;
+        uint16_t _count;
+        uint8_t _bpp;
+        uint8_t *_pixels;
+        uint8_t *_frames[2];
+        uint32_t _frame_size;
+        // frame buffer on the wire, or -1
+        volatile int8_t _sending;
+        // frame buffer waiting for it
+        volatile bool _queued;
+        volatile uint8_t _queued_index;
+
+        void encode(uint8_t *frame);
+        void startFrame(uint8_t index);
+        static void onFrameSent(SPIJob *job, void *param);
+};
+
+/* Strip of N pixels of BPP bytes with its own storage */
+template <uint16_t N, uint8_t BPP = 3>
+class WS2812N : public WS2812
+{
+    public:
+        WS2812N(SPIClass &spi) : WS2812(spi, N, BPP, _pixel_storage, _frame_storage) {}
+
+    private:
+        uint8_t _pixel_storage[N * BPP];
+        uint8_t _frame_storage[2 * WS2812_FRAME_SIZE(N, BPP)];
+};
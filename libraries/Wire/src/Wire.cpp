@@ -32,9 +32,6 @@ extern "C" {
 #define WIRE_RESET_ON_BUSY 1
 #endif
 
-void (*TwoWire::user_onRequest)(void);
-void (*TwoWire::user_onReceive)(int);
-
 #if defined(HAVE_I2C)
 TwoWire Wire(SDA, SCL, 0);
 #endif
@@ -43,28 +40,21 @@ TwoWire Wire(SDA, SCL, 0);
 TwoWire Wire1(SDA1, SCL1, 1);
 #endif
 
-ring_buffer TwoWire::_rx_buffer = {{0}, 0, 0};
-ring_buffer TwoWire::_tx_buffer = {{0}, 0, 0};
-
-uint8_t TwoWire::txAddress = 0;
-
 TwoWire::TwoWire(uint8_t sda, uint8_t scl, int i2c_index)
 {
+    txAddress = 0;
     user_onRequest = NULL;
+    user_onReceive = NULL;
+    user_onRegisterWrite = NULL;
     transmitting = 0;
     _i2c.sda = DIGITAL_TO_PINNAME(sda);
     _i2c.scl = DIGITAL_TO_PINNAME(scl);
 
-    _i2c.rx_buffer_ptr = _rx_buffer.buffer;
-    _i2c.tx_buffer_ptr = _tx_buffer.buffer;
-    _i2c.tx_count = 0;
-    _i2c.rx_count = 0;
+    resetBuffers();
     _i2c.index = i2c_index;
-
-    _rx_buffer.head = 0;
-    _rx_buffer.tail = 0;
-    _tx_buffer.head = 0;
-    _tx_buffer.tail = 0;
+    _async_rx = 0;
+    user_onTransferComplete = NULL;
+    i2c_attach_master_callback(&_i2c, onMasterComplete, this);
 }
 
 /*!
@@ -92,8 +82,8 @@ void TwoWire::begin(uint8_t address)
 
     i2c_slaves_interrupt_enable(&_i2c);
 
-    i2c_attach_slave_tx_callback(&_i2c, onRequestService);
-    i2c_attach_slave_rx_callback(&_i2c, onReceiveService);
+    i2c_attach_slave_tx_callback(&_i2c, onRequestService, this);
+    i2c_attach_slave_rx_callback(&_i2c, onReceiveService, this);
 }
 
 void TwoWire::begin(int address)
@@ -104,15 +94,16 @@ void TwoWire::begin(int address)
 void TwoWire::end(void)
 {
     //clear any received data
-    _rx_buffer.head = _rx_buffer.tail;
+    _rx_buffer.clear();
     //wait for any outstanding data to be sent
     flush();
     i2c_deinit(_i2c.i2c);
 }
 
-uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint32_t iaddress, uint8_t isize,
-                             uint8_t sendStop)
+uint16_t TwoWire::requestFrom(uint8_t address, uint16_t quantity, uint32_t iaddress, uint8_t isize,
+                              uint8_t sendStop)
 {
+    waitIdle();
 
     if (isize > 0) {
         // send internal address; this mode allows sending a repeated start to access
@@ -134,17 +125,17 @@ uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint32_t iaddres
     }
 
     // clamp to buffer length
-    if (quantity > WIRE_BUFFER_LENGTH) {
-        quantity = WIRE_BUFFER_LENGTH;
+    if (quantity > _rx_buffer.capacity()) {
+        quantity = _rx_buffer.capacity();
     }
 
-    _rx_buffer.head = 0;
-    if (I2C_OK == i2c_master_receive(&_i2c, address << 1, &_rx_buffer.buffer[_rx_buffer.head], quantity,
-                                     sendStop)) {
-        _rx_buffer.head = quantity;
+    // receive straight into the (empty) rx buffer
+    uint8_t *rx;
+    _rx_buffer.reset();
+    _rx_buffer.pushSpan(&rx);
+    if (I2C_OK == i2c_master_receive(&_i2c, address << 1, rx, quantity, sendStop)) {
+        _rx_buffer.commitPush(quantity);
     }
-    // set rx buffer iterator vars
-    _rx_buffer.tail = 0;
     return quantity;
 }
 
@@ -158,14 +149,15 @@ uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity)
     return requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)true);
 }
 
-uint8_t TwoWire::requestFrom(int address, int quantity)
+uint16_t TwoWire::requestFrom(int address, int quantity)
 {
-    return requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)true);
+    return requestFrom((uint8_t)address, (uint16_t)quantity, (uint32_t)0, (uint8_t)0, (uint8_t)true);
 }
 
-uint8_t TwoWire::requestFrom(int address, int quantity, int sendStop)
+uint16_t TwoWire::requestFrom(int address, int quantity, int sendStop)
 {
-    return requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)sendStop);
+    return requestFrom((uint8_t)address, (uint16_t)quantity, (uint32_t)0, (uint8_t)0,
+                       (uint8_t)sendStop);
 }
 
 /*!
@@ -176,13 +168,13 @@ uint8_t TwoWire::requestFrom(int address, int quantity, int sendStop)
 */
 void TwoWire::beginTransmission(uint8_t address)
 {
+    waitIdle();
     // indicate that we are transmitting
     transmitting = 1;
     // set address of targeted slave
     txAddress = address << 1;
     // reset tx buffer iterator vars
-    _tx_buffer.head = 0;
-    _tx_buffer.tail = 0;
+    _tx_buffer.reset();
 }
 
 void TwoWire::beginTransmission(int address)
@@ -192,34 +184,124 @@ void TwoWire::beginTransmission(int address)
 
 uint8_t TwoWire::endTransmission(uint8_t sendStop)
 {
+    waitIdle();
     int8_t ret = 4;
-    ret = i2c_master_transmit(&_i2c, txAddress, &_tx_buffer.buffer[_tx_buffer.tail], _i2c.tx_count,
-                              sendStop);
+    uint8_t *tx;
+    // the buffer is reset by beginTransmission(), so its contents are contiguous
+    size_t length = _tx_buffer.popSpan(&tx);
+    ret = i2c_master_transmit(&_i2c, txAddress, tx, length, sendStop);
 
-    _tx_buffer.head = 0;
-    _tx_buffer.tail = 0;
-    _i2c.tx_count = 0;
+    _tx_buffer.reset();
     /* indicate that we are done transmitting */
     transmitting = 0;
+    resetOnBusy(ret);
+    return ret;
+}
+
+void TwoWire::resetOnBusy(uint8_t status)
+{
 #if WIRE_RESET_ON_BUSY
     /*
      * The peripheral detects a BUSY condition if there is unexpected bus
-     * activity. This can happen due to glitches. It won't clear the BUSY
-     * condition until it detects a STOP condition, or the peripheral is
-     * reset. On a single-controller bus, this effectively means we have
-     * to reset the peripheral to clear the BUSY condition.
+     * activity. This can happen due to glitches, or a slave holding SDA
+     * low after a reset mid-byte. It won't clear the BUSY condition until
+     * it detects a STOP condition, or the peripheral is reset. On a
+     * single-controller bus, this effectively means we have to clear the
+     * bus and reset the peripheral. A transfer that found the peripheral
+     * taken by another, from an interrupt, is also I2C_BUSY; that one is
+     * left alone.
      */
-    if (I2C_BUSY == ret) {
-        end();
-        begin();
-        if (0 != clock) {
-            setClock(clock);
-        }
+    if ((I2C_BUSY == status) && !i2c_master_busy(&_i2c)) {
+        recoverBus();
     }
+#else
+    (void)status;
 #endif
+}
+
+i2c_stats_t TwoWire::stats(bool reset)
+{
+    i2c_stats_t snapshot;
+    i2c_get_stats(&_i2c, &snapshot, reset);
+    return snapshot;
+}
+
+/*!
+    \brief      clock a stuck bus free, send a STOP and reset the peripheral
+    \param[in]  none
+    \param[out] none
+    \retval     0 if the bus is free, otherwise an endTransmission() error code
+*/
+uint8_t TwoWire::recoverBus(void)
+{
+    // a transfer still running is aborted
+    _rx_buffer.clear();
+    return i2c_bus_recover(&_i2c);
+}
+
+/*!
+    \brief      write a buffer to a slave in one transaction
+    \param[in]  address: the 7-bit slave address
+    \param[in]  data: the bytes to send, used in place
+    \param[in]  length: number of bytes; 0 only addresses the slave
+    \param[in]  sendStop: whether to release the bus afterwards
+    \param[out] none
+    \retval     0 on success, otherwise an endTransmission() error code
+*/
+uint8_t TwoWire::writeTo(uint8_t address, const uint8_t *data, size_t length, bool sendStop)
+{
+    uint8_t ret;
+
+    if (length > 0xFFFF) {
+        return I2C_DATA_TOO_LONG;
+    }
+    waitIdle();
+    ret = i2c_master_transmit(&_i2c, address << 1, (uint8_t *)data, length, sendStop);
+    resetOnBusy(ret);
+    return ret;
+}
+
+/*!
+    \brief      read from a slave straight into a buffer
+    \param[in]  address: the 7-bit slave address
+    \param[in]  length: number of bytes to read
+    \param[in]  sendStop: whether to release the bus afterwards
+    \param[out] data: receives the bytes
+    \retval     0 on success, otherwise an endTransmission() error code
+*/
+uint8_t TwoWire::readFrom(uint8_t address, uint8_t *data, size_t length, bool sendStop)
+{
+    uint8_t ret;
+
+    if ((0 == length) || (length > 0xFFFF)) {
+        return I2C_DATA_TOO_LONG;
+    }
+    waitIdle();
+    ret = i2c_master_receive(&_i2c, address << 1, data, length, sendStop);
+    resetOnBusy(ret);
     return ret;
 }
 
+/*!
+    \brief      write to a slave, then read its reply after a repeated START
+    \param[in]  address: the 7-bit slave address
+    \param[in]  tx: the bytes to send, typically a register address
+    \param[in]  tx_length: number of bytes to send
+    \param[in]  rx_length: number of bytes to read
+    \param[out] rx: receives the reply
+    \retval     0 on success, otherwise an endTransmission() error code
+*/
+uint8_t TwoWire::writeRead(uint8_t address, const uint8_t *tx, size_t tx_length, uint8_t *rx,
+                           size_t rx_length)
+{
+    uint8_t ret = writeTo(address, tx, tx_length, false);
+
+    if (I2C_OK != ret) {
+        return ret;
+    }
+    return readFrom(address, rx, rx_length, true);
+}
+
 //  This provides backwards compatibility with the original
 //  definition, and expected behaviour, of endTransmission
 //
@@ -235,9 +317,10 @@ size_t TwoWire::write(uint8_t data)
 {
     size_t ret = 1;
     if (transmitting) {
-        _tx_buffer.buffer[_tx_buffer.head] = data;
-        _tx_buffer.head = (_tx_buffer.head + 1) % WIRE_BUFFER_LENGTH;
-        _i2c.tx_count++;
+        // don't wrap around over bytes not sent yet
+        if (!_tx_buffer.push(data)) {
+            ret = 0;
+        }
     } else {
         // in slave send mode
         // reply to master
@@ -257,13 +340,10 @@ size_t TwoWire::write(uint8_t data)
   */
 size_t TwoWire::write(const uint8_t *data, size_t quantity)
 {
-    size_t i;
     size_t ret = quantity;
 
     if (transmitting) {
-        for (i = 0; i < quantity; ++i) {
-            write(data[i]);
-        }
+        ret = _tx_buffer.write(data, quantity);
     } else {
         // in slave send mode
         // reply to master
@@ -276,69 +356,90 @@ size_t TwoWire::write(const uint8_t *data, size_t quantity)
 
 int TwoWire::available(void)
 {
-    return ((unsigned int)(WIRE_BUFFER_LENGTH + _rx_buffer.head - _rx_buffer.tail)) %
-           WIRE_BUFFER_LENGTH;
+    return _rx_buffer.available();
 }
 
 int TwoWire::read(void)
 {
-    unsigned char c;
-
-    if (_rx_buffer.head > _rx_buffer.tail) {
+    uint8_t c;
 
-        c = _rx_buffer.buffer[_rx_buffer.tail];
-
-        _rx_buffer.tail = (_rx_buffer.tail + 1) % WIRE_BUFFER_LENGTH;
-        return c;
-    } else {
+    if (!_rx_buffer.pop(c)) {
         /* TODO: there are no elements in the ringbuffer... think about better error handling here! */
         return -1;
     }
+    return c;
 }
 
 int TwoWire::peek(void)
 {
-    if (_rx_buffer.head == _rx_buffer.tail) {
+    uint8_t c;
+
+    if (!_rx_buffer.peek(c)) {
         return -1;
-    } else {
-        return _rx_buffer.buffer[_rx_buffer.tail];
     }
+    return c;
 }
 
 void TwoWire::flush()
 {
     //wait for transmit data to be sent
-    while ((_tx_buffer.head != _tx_buffer.tail)) {
+    while (!_tx_buffer.isEmpty()) {
         // wait for transmit data to be sent
     }
 }
 
 
-void TwoWire::onReceiveService(uint8_t *inBytes, int numBytes)
+void TwoWire::onReceiveService(void *param, uint8_t *inBytes, int numBytes)
 {
+    TwoWire *wire = (TwoWire *)param;
 
-    if (user_onReceive) {
-        _rx_buffer.head = numBytes;
-        _rx_buffer.tail = 0;
+    if (wire->user_onReceive) {
+        // the slave ISR has already filled the buffer from its start
+        wire->_rx_buffer.reset();
+        wire->_rx_buffer.commitPush(numBytes);
         // alert user program
-        user_onReceive(numBytes);
+        wire->user_onReceive(numBytes);
     }
 }
 
 // behind the scenes function that is called when data is requested
-void TwoWire::onRequestService(void)
+void TwoWire::onRequestService(void *param)
 {
+    TwoWire *wire = (TwoWire *)param;
+
     // don't bother if user hasn't registered a callback
-    if (user_onRequest) {
+    if (wire->user_onRequest) {
         // reset tx buffer iterator vars
         // !!! this will kill any pending pre-master sendTo() activity
-        _tx_buffer.head = 0;
-        _tx_buffer.tail = 0;
+        wire->_tx_buffer.reset();
         // alert user program
-        user_onRequest();
+        wire->user_onRequest();
     }
 
 }
+void TwoWire::onRegisterWriteService(void *param, uint16_t first, uint16_t count)
+{
+    TwoWire *wire = (TwoWire *)param;
+
+    if (wire->user_onRegisterWrite) {
+        wire->user_onRegisterWrite(first, count);
+    }
+}
+
+/*!
+    \brief      serve slave accesses from a register file
+    \param[in]  regs: the registers, NULL to go back to onReceive()/onRequest()
+    \param[in]  size: number of registers, up to 256
+    \param[in]  onWrite: called after the master wrote registers, or NULL
+    \param[out] none
+    \retval     none
+*/
+void TwoWire::setRegisterFile(uint8_t *regs, uint16_t size, void (*onWrite)(uint16_t, uint16_t))
+{
+    user_onRegisterWrite = onWrite;
+    i2c_slave_regfile(&_i2c, regs, (NULL == regs) ? 0 : size, onRegisterWriteService, this);
+}
+
 // sets function called on slave write
 void TwoWire::onReceive(void (*function)(int))
 {
@@ -351,6 +452,144 @@ void TwoWire::onRequest(void (*function)(void))
     user_onRequest = function;
 }
 
+/*!
+    \brief      replace the transmit and receive buffers
+    \param[in]  rx: receive buffer, or NULL for the built-in one
+    \param[in]  rx_length: size of rx in bytes
+    \param[in]  tx: transmit buffer, or NULL for the built-in one
+    \param[in]  tx_length: size of tx in bytes
+    \param[out] none
+    \retval     none
+*/
+void TwoWire::setBuffers(uint8_t *rx, size_t rx_length, uint8_t *tx, size_t tx_length)
+{
+    waitIdle();
+    if ((NULL == rx) || (0 == rx_length)) {
+        _rx_buffer.detach();
+    } else {
+        _rx_buffer.attach(rx, (rx_length > 0x8000) ? 0x8000 : rx_length);
+    }
+    if ((NULL == tx) || (0 == tx_length)) {
+        _tx_buffer.detach();
+    } else {
+        _tx_buffer.attach(tx, (tx_length > 0x8000) ? 0x8000 : tx_length);
+    }
+    resetBuffers();
+}
+
+// point the slave side of the driver at the start of the buffers
+void TwoWire::resetBuffers(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    _rx_buffer.reset();
+    _tx_buffer.reset();
+    _i2c.rx_size = _rx_buffer.pushSpan(&_i2c.rx_buffer_ptr);
+    _i2c.tx_size = _tx_buffer.pushSpan(&_i2c.tx_buffer_ptr);
+    _i2c.tx_count = 0;
+    _i2c.rx_count = 0;
+    __set_PRIMASK(primask);
+}
+
+/*!
+    \brief      start sending the bytes queued since beginTransmission()
+    \param[in]  sendStop: whether to release the bus afterwards
+    \param[out] none
+    \retval     0 once started, otherwise an endTransmission() error code
+*/
+uint8_t TwoWire::endTransmissionAsync(uint8_t sendStop)
+{
+    uint8_t *tx;
+
+    waitIdle();
+    // the buffer is reset by beginTransmission(), so its contents are contiguous
+    size_t length = _tx_buffer.popSpan(&tx);
+    return i2c_master_transmit_it(&_i2c, txAddress, tx, length, sendStop);
+}
+
+/*!
+    \brief      start reading from a slave into the receive buffer
+    \param[in]  address: the 7-bit slave address
+    \param[in]  quantity: number of bytes to read, clamped to the buffer length
+    \param[in]  sendStop: whether to release the bus afterwards
+    \param[out] none
+    \retval     0 once started, otherwise an endTransmission() error code
+*/
+uint8_t TwoWire::requestFromAsync(uint8_t address, uint16_t quantity, uint8_t sendStop)
+{
+    uint8_t *rx;
+    uint8_t ret;
+
+    waitIdle();
+    if (quantity > _rx_buffer.capacity()) {
+        quantity = _rx_buffer.capacity();
+    }
+    _rx_buffer.reset();
+    _rx_buffer.pushSpan(&rx);
+    _async_rx = quantity;
+    ret = i2c_master_receive_it(&_i2c, address << 1, rx, quantity, sendStop);
+    if (I2C_OK != ret) {
+        _async_rx = 0;
+    }
+    return ret;
+}
+
+/*!
+    \brief      run a list of transactions from the I2C interrupt
+    \param[in]  ops: the transactions, with 7-bit addresses
+    \param[in]  count: number of transactions
+    \param[in]  callback: called once all have run, or NULL
+    \param[in]  param: passed back to callback
+    \param[out] none
+    \retval     0 once started, otherwise an endTransmission() error code
+*/
+uint8_t TwoWire::submit(i2c_op_t *ops, uint16_t count, void (*callback)(void *), void *param)
+{
+    waitIdle();
+    return i2c_master_queue(&_i2c, ops, count, callback, param);
+}
+
+bool TwoWire::finished(void)
+{
+    return !i2c_master_busy(&_i2c);
+}
+
+uint8_t TwoWire::lastStatus(void)
+{
+    return i2c_master_status(&_i2c);
+}
+
+// sets function called from interrupt context when an async transfer ends
+void TwoWire::onTransferComplete(void (*function)(uint8_t))
+{
+    user_onTransferComplete = function;
+}
+
+void TwoWire::waitIdle(void)
+{
+    while (i2c_master_busy(&_i2c)) {
+        // an async transfer still owns the buffers
+    }
+}
+
+void TwoWire::onMasterComplete(void *param, i2c_status_enum status)
+{
+    TwoWire *wire = (TwoWire *)param;
+
+    if (wire->_async_rx) {
+        if (I2C_OK == status) {
+            wire->_rx_buffer.commitPush(wire->_async_rx);
+        }
+        wire->_async_rx = 0;
+    } else {
+        wire->_tx_buffer.reset();
+        wire->transmitting = 0;
+    }
+    if (wire->user_onTransferComplete) {
+        wire->user_onTransferComplete(status);
+    }
+}
+
 void TwoWire::setClock(uint32_t clock_hz)
 {
     // Save in case we need to restart for recovery
@@ -24,28 +24,25 @@
 
 #include "api/Stream.h"
 #include "Arduino.h"
+#include "SPSCRingBuffer.h"
 extern "C" {
 #include "utility/twi.h"
 }
 
+// Length of each instance's built-in transmit and receive buffers, a power
+// of two. setBuffers() replaces them with caller-provided storage.
 #if !defined(WIRE_BUFFER_LENGTH)
-#define WIRE_BUFFER_LENGTH 32
+#define WIRE_BUFFER_LENGTH I2C_BUFFER_SIZE
 #endif
 
 #define MASTER_ADDRESS 0x33
 
-typedef struct {
-    unsigned char buffer[WIRE_BUFFER_LENGTH];
-    int head;
-    int tail;
-} ring_buffer;
-
 class TwoWire : public Stream
 {
     private:
-        static ring_buffer _rx_buffer;
-        static ring_buffer _tx_buffer;
-        static uint8_t txAddress;
+        SPSCRingBufferN<uint8_t, WIRE_BUFFER_LENGTH> _rx_buffer;
+        SPSCRingBufferN<uint8_t, WIRE_BUFFER_LENGTH> _tx_buffer;
+        uint8_t txAddress;
 
 
         uint8_t transmitting;
@@ -54,10 +51,20 @@ class TwoWire : public Stream
         i2c_t _i2c;
         uint32_t clock;
 
-        static void (*user_onRequest)(void);
-        static void (*user_onReceive)(int);
-        static void onRequestService(void);
-        static void onReceiveService(uint8_t *, int);
+        void (*user_onRequest)(void);
+        void (*user_onReceive)(int);
+        void (*user_onRegisterWrite)(uint16_t, uint16_t);
+        static void onRequestService(void *);
+        static void onReceiveService(void *, uint8_t *, int);
+        static void onRegisterWriteService(void *, uint16_t, uint16_t);
+        void resetBuffers(void);
+
+        // bytes an async requestFrom() is reading into _rx_buffer
+        volatile uint16_t _async_rx;
+        void (*user_onTransferComplete)(uint8_t);
+        static void onMasterComplete(void *, i2c_status_enum);
+        void waitIdle(void);
+        void resetOnBusy(uint8_t status);
 
 
 
@@ -69,15 +76,26 @@ class TwoWire : public Stream
         void begin(int);
         void end();
         void setClock(uint32_t);
+        // Master transfer, error and timing counters since startup or the
+        // last stats(true)
+        i2c_stats_t stats(bool reset = false);
+        // Free a bus held by a slave: up to nine SCL pulses, a STOP, then a
+        // peripheral reset that keeps the clock and addressing settings
+        uint8_t recoverBus(void);
+        // SCL rate actually configured, from the APB1 clock and the divider
+        uint32_t getClock(void)
+        {
+            return _i2c.scl_hz;
+        }
         void beginTransmission(uint8_t);
         void beginTransmission(int);
         uint8_t endTransmission(void);
         uint8_t endTransmission(uint8_t);
         uint8_t requestFrom(uint8_t, uint8_t);
         uint8_t requestFrom(uint8_t, uint8_t, uint8_t);
-        uint8_t requestFrom(uint8_t, uint8_t, uint32_t, uint8_t, uint8_t);
-        uint8_t requestFrom(int, int);
-        uint8_t requestFrom(int, int, int);
+        uint16_t requestFrom(uint8_t, uint16_t, uint32_t, uint8_t, uint8_t);
+        uint16_t requestFrom(int, int);
+        uint16_t requestFrom(int, int, int);
         virtual size_t write(uint8_t);
         virtual size_t write(const uint8_t *, size_t);
         virtual int available(void);
@@ -87,6 +105,61 @@ class TwoWire : public Stream
         void onReceive(void (*)(int));
         void onRequest(void (*)(void));
 
+        // Slave register file, after begin(address): the master's first
+        // byte of a write selects a register, then reads and writes go to
+        // and from regs with an auto-incrementing pointer, by DMA where
+        // available, without calling onReceive()/onRequest(). onWrite gets
+        // the first register and the number of bytes written (wrapping at
+        // size), once per write, from interrupt context. NULL regs goes back
+        // to the callbacks.
+        void setRegisterFile(uint8_t *regs, uint16_t size,
+                             void (*onWrite)(uint16_t first, uint16_t count) = NULL);
+
+        // Blocking master transfers straight from and into the caller's
+        // buffers, bypassing the Stream buffers. Addresses are 7-bit; the
+        // result is an endTransmission() error code. writeRead() writes,
+        // then reads back after a repeated START.
+        uint8_t writeTo(uint8_t address, const uint8_t *data, size_t length, bool sendStop = true);
+        uint8_t readFrom(uint8_t address, uint8_t *data, size_t length, bool sendStop = true);
+        uint8_t writeRead(uint8_t address, const uint8_t *tx, size_t tx_length, uint8_t *rx,
+                          size_t rx_length);
+
+        // Use caller-provided storage instead of the built-in buffers, so a
+        // whole frame of any length fits in one transaction. Lengths are
+        // rounded down to a power of two, at most 32768; NULL selects the
+        // built-in buffer again. Call it while the bus is idle.
+        void setBuffers(uint8_t *rx, size_t rx_length, uint8_t *tx, size_t tx_length);
+        size_t rxBufferLength(void)
+        {
+            return _rx_buffer.capacity();
+        }
+        size_t txBufferLength(void)
+        {
+            return _tx_buffer.capacity();
+        }
+
+        // Non-blocking master transfers, run from the I2C interrupt. They
+        // return 0 once the transfer is started, or an endTransmission()
+        // error code if it couldn't be. The transmit buffer, or the receive
+        // buffer for requestFromAsync(), belongs to the transfer until
+        // finished(); lastStatus() then gives its endTransmission()-style
+        // result and the onTransferComplete() callback has been called, from
+        // interrupt context.
+        uint8_t endTransmissionAsync(uint8_t sendStop = true);
+        uint8_t requestFromAsync(uint8_t address, uint16_t quantity, uint8_t sendStop = true);
+        bool finished(void);
+        uint8_t lastStatus(void);
+        void onTransferComplete(void (*)(uint8_t));
+
+        // Queued transactions, possibly for several devices: the ops run
+        // back to back from the I2C interrupt, with a repeated START after
+        // each write. Every op gets its own endTransmission()-style status,
+        // I2C_BUSY until it has run, and the callback is called once, from
+        // interrupt context, after the last one. The ops and their buffers
+        // belong to the queue until finished().
+        uint8_t submit(i2c_op_t *ops, uint16_t count, void (*callback)(void *) = NULL,
+                       void *param = NULL);
+
         inline size_t write(unsigned long n)
         {
             return write((uint8_t)n);
@@ -30,6 +30,9 @@ OF SUCH DAMAGE.
 #include "utility/twi.h"
 #include "pinmap.h"
 #include "twi.h"
+#include "dma.h"
+#include "systick.h"
+#include <string.h>
 
 
 #ifdef __cplusplus
@@ -49,19 +52,20 @@ typedef enum {
 static struct i2c_s *obj_s_buf[I2C_NUM] = {NULL};
 
 /*
- * Timeouts assume -O0, 120MHz SYSCLK, 60MHz APB1, and 400kHz I2C bus
+ * Timeouts are in microseconds, measured on SysTick, so they hold at any
+ * CPU clock and optimization level, and with interrupts masked.
  */
 /*
- * around 27.8usec, or 11 bit times at 400kHz.
+ * 11 bit times at 100kHz.
  * You might want to increase it if you have multiple controllers.
  */
 #ifndef WIRE_I2C_FLAG_TIMEOUT
-#define WIRE_I2C_FLAG_TIMEOUT 72
+#define WIRE_I2C_FLAG_TIMEOUT 110
 #endif
 
-/* around 1ms. Increase if your target does lots of clock stretching */
+/* Increase if your target does lots of clock stretching */
 #ifndef WIRE_I2C_ACK_TIMEOUT
-#define WIRE_I2C_ACK_TIMEOUT 2587
+#define WIRE_I2C_ACK_TIMEOUT 1000
 #endif
 
 #ifndef WIRE_I2C_FLAG_TIMEOUT_START
@@ -89,8 +93,164 @@ static struct i2c_s *obj_s_buf[I2C_NUM] = {NULL};
 #define WIRE_I2C_FLAG_TIMEOUT_BYTE_RECEIVED WIRE_I2C_ACK_TIMEOUT
 #endif
 
+/*
+ * Interrupt-driven transfers at least this long go through DMA when the
+ * peripheral's channel is free. Reads of one or two bytes never do: they
+ * need the ACK/ACKPOS sequence of the interrupt engine.
+ */
+#ifndef WIRE_I2C_DMA_THRESHOLD
+#define WIRE_I2C_DMA_THRESHOLD 4
+#endif
+
 #define I2C_S(obj)    (struct i2c_s *) (obj)
 
+static i2c_status_enum i2c_master_start_it(struct i2c_s *obj_s, uint8_t address, uint32_t direction,
+                                           uint8_t *data, uint16_t length, uint8_t stop,
+                                           bool blocking);
+static i2c_status_enum i2c_master_transfer_wait(struct i2c_s *obj_s, uint8_t address,
+                                                uint32_t direction, uint8_t *data,
+                                                uint16_t length, uint8_t stop);
+
+/*
+ * A deadline counted in SysTick cycles. It only relies on the counter, not
+ * on the SysTick interrupt, but must be polled at least once per SysTick
+ * period (1ms).
+ */
+typedef struct {
+    uint32_t last;
+    uint32_t left;
+} i2c_deadline_t;
+
+static void i2c_deadline_start(i2c_deadline_t *deadline, uint32_t us)
+{
+    uint32_t per_us = SystemCoreClock / 1000000U;
+
+    deadline->last = SysTick->VAL;
+    deadline->left = (us > UINT32_MAX / per_us) ? UINT32_MAX : us * per_us;
+}
+
+static bool i2c_deadline_expired(i2c_deadline_t *deadline)
+{
+    uint32_t now = SysTick->VAL;
+    uint32_t elapsed;
+
+    /* SysTick counts down, then reloads */
+    if (deadline->last >= now) {
+        elapsed = deadline->last - now;
+    } else {
+        elapsed = deadline->last + SysTick->LOAD + 1 - now;
+    }
+    deadline->last = now;
+    if (elapsed >= deadline->left) {
+        deadline->left = 0;
+        return true;
+    }
+    deadline->left -= elapsed;
+    return false;
+}
+
+static void i2c_delay_us(uint32_t us)
+{
+    i2c_deadline_t deadline;
+
+    i2c_deadline_start(&deadline, us);
+    while (!i2c_deadline_expired(&deadline)) {
+    }
+}
+
+/* count the hard errors behind an I2C_ERROR */
+static void i2c_stats_errors(struct i2c_s *obj_s, uint32_t stat0)
+{
+    if (stat0 & I2C_STAT0_LOSTARB) {
+        obj_s->stats.arbitration_lost++;
+    }
+    if (stat0 & I2C_STAT0_BERR) {
+        obj_s->stats.bus_errors++;
+    }
+}
+
+/* account for a finished master transfer */
+static void i2c_stats_record(struct i2c_s *obj_s, i2c_status_enum status, uint32_t bytes,
+                             uint32_t start_us)
+{
+    i2c_stats_t *stats = &obj_s->stats;
+    uint32_t elapsed = getCurrentMicros() - start_us;
+
+    /* the millisecond count stalls while interrupts are masked */
+    if (elapsed & 0x80000000U) {
+        elapsed = 0;
+    }
+    stats->transactions++;
+    stats->bytes += bytes;
+    switch (status) {
+        case I2C_NACK_ADDR:
+            stats->nack_addr++;
+            break;
+        case I2C_NACK_DATA:
+            stats->nack_data++;
+            break;
+        case I2C_TIMEOUT:
+            stats->timeouts++;
+            break;
+        default:
+            break;
+    }
+    if ((1 == stats->transactions) || (elapsed < stats->time_min_us)) {
+        stats->time_min_us = elapsed;
+    }
+    if (elapsed > stats->time_max_us) {
+        stats->time_max_us = elapsed;
+    }
+    stats->time_total_us += elapsed;
+}
+
+/* From interrupt context, or with interrupts masked, transfers are polled */
+static inline bool i2c_master_can_wait(void)
+{
+    return (0 == __get_IPSR()) && (0 == __get_PRIMASK());
+}
+
+/** Take the peripheral for a polled master transfer
+ *
+ * Give it back by clearing obj_s->polled.
+ *
+ * @param obj_s The I2C object
+ * @return false while an interrupt-driven transfer, a queue or another
+ * polled transfer has it
+ */
+static bool i2c_master_claim(struct i2c_s *obj_s)
+{
+    bool claimed = false;
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if ((I2C_XFER_IDLE == obj_s->xfer_state) && (NULL == obj_s->queue_ops) && !obj_s->polled) {
+        obj_s->polled = true;
+        claimed = true;
+    }
+    __set_PRIMASK(primask);
+    return claimed;
+}
+
+/* DMA for the data phase is only available on F30x/E50x, see dma.h */
+#if defined(GD32F30x) || defined(GD32E50X)
+typedef struct {
+    uint32_t dma;
+    dma_channel_enum tx;
+    dma_channel_enum rx;
+} i2c_dma_t;
+
+/* DMA request lines, see the DMA request mapping */
+static const i2c_dma_t i2c_dma[I2C_NUM] = {
+#if defined(I2C0)
+    {DMA0, DMA_CH5, DMA_CH6},
+#endif
+#if defined(I2C1)
+    {DMA0, DMA_CH3, DMA_CH4},
+#endif
+};
+#endif
+
 #if defined(GD32F1x0) || defined(GD32F3x0) || defined(GD32F4xx) || defined(GD32E23x)|| defined(GD32E50X)
 #define GD32_I2C_FLAG_IS_TRANSMTR_OR_RECVR I2C_FLAG_TR
 #else
@@ -139,7 +299,7 @@ void i2c_init(i2c_t *obj, PinName sda, PinName scl, uint8_t address)
     pinmap_pinout(scl, PinMap_I2C_SCL);
 
     /* I2C clock configure */
-    i2c_clock_config(obj->i2c, default_speed, I2C_DTCY_2);
+    i2c_set_clock(obj, default_speed);
 
     /* I2C address configure */
     i2c_mode_addr_config(obj->i2c, I2C_I2CMODE_ENABLE, I2C_ADDFORMAT_7BITS, address);
@@ -149,17 +309,23 @@ void i2c_init(i2c_t *obj, PinName sda, PinName scl, uint8_t address)
     i2c_enable(obj->i2c);
     /* enable acknowledge */
     i2c_ack_config(obj->i2c, I2C_ACK_ENABLE);
+    obj_s->slave_irq = false;
+    obj_s->xfer_state = I2C_XFER_IDLE;
+    obj_s->xfer_status = I2C_OK;
+    obj_s->polled = false;
+    obj_s->queue_ops = NULL;
+    obj_s->regfile_phase = I2C_REGFILE_IDLE;
+    obj_s->regfile_dma = false;
     /* get obj_s_buf */
     obj_s_buf[obj_s->index] = obj_s;
 }
 
-/** Enable the I2C interrupt
+/** Enable the I2C event and error interrupt lines in the NVIC
  *
- * @param obj       The I2C object
+ * @param obj_s     The I2C object
  */
-void i2c_slaves_interrupt_enable(i2c_t *obj)
+static void i2c_irq_enable(struct i2c_s *obj_s)
 {
-    struct i2c_s *obj_s = I2C_S(obj);
     switch (obj_s->i2c) {
         case I2C0:
             /* enable I2C0 interrupt */
@@ -184,7 +350,18 @@ void i2c_slaves_interrupt_enable(i2c_t *obj)
         default:
             break;
     }
+}
+
+/** Enable the I2C interrupt
+ *
+ * @param obj       The I2C object
+ */
+void i2c_slaves_interrupt_enable(i2c_t *obj)
+{
+    struct i2c_s *obj_s = I2C_S(obj);
 
+    i2c_irq_enable(obj_s);
+    obj_s->slave_irq = true;
     i2c_interrupt_enable(obj_s->i2c, I2C_INT_ERR);
     i2c_interrupt_enable(obj_s->i2c, I2C_INT_BUF);
     i2c_interrupt_enable(obj_s->i2c, I2C_INT_EV);
@@ -194,7 +371,7 @@ void i2c_slaves_interrupt_enable(i2c_t *obj)
  *
  * @param obj the I2C object
  * @param flag the I2C_STAT0 flag to wait for
- * @param timeout timeout
+ * @param timeout timeout in microseconds
  *
  * @return I2C_OK on success, I2C_ERROR on error, I2C_TIMEOUT on timeout,
  * I2C_DATA_NACK on NACK
@@ -202,15 +379,21 @@ void i2c_slaves_interrupt_enable(i2c_t *obj)
 static i2c_status_enum i2c_wait_flag(i2c_t *obj, uint32_t flag, uint32_t timeout)
 {
     i2c_status_enum ret = I2C_ERROR;
+    i2c_deadline_t deadline;
+    bool expired = false;
     uint32_t stat0;
+
+    i2c_deadline_start(&deadline, timeout);
     do {
         stat0 = I2C_STAT0(obj->i2c);
         if (stat0 & (flag | I2C_STAT0_AERR | I2C_STAT0_LOSTARB | I2C_STAT0_BERR)) {
             break;
         }
-    } while (--timeout != 0);
+        expired = i2c_deadline_expired(&deadline);
+    } while (!expired);
     /* Clear any error flags that were set */
     I2C_STAT0(obj->i2c) = stat0 & ~(I2C_STAT0_AERR | I2C_STAT0_LOSTARB | I2C_STAT0_BERR);
+    i2c_stats_errors(obj, stat0);
     if (stat0 & flag) {
         ret = I2C_OK;
     }
@@ -222,7 +405,7 @@ static i2c_status_enum i2c_wait_flag(i2c_t *obj, uint32_t flag, uint32_t timeout
     if (stat0 & (I2C_STAT0_LOSTARB | I2C_STAT0_BERR)) {
         ret = I2C_ERROR;
     }
-    if (0 == timeout) {
+    if (expired) {
         ret = I2C_TIMEOUT;
     }
     return ret;
@@ -260,19 +443,22 @@ i2c_status_enum i2c_byte_write(i2c_t *obj, int data, int last)
 static i2c_status_enum i2c_start(i2c_t *obj)
 {
     i2c_status_enum ret = I2C_ERROR;
-    uint32_t timeout, stat0, stat1;
+    i2c_deadline_t deadline;
+    bool expired = false;
+    uint32_t stat0, stat1;
 
     /* generate a START condition */
     i2c_start_on_bus(obj->i2c);
 
     /* ensure the i2c has been started successfully */
-    timeout = WIRE_I2C_FLAG_TIMEOUT_START;
+    i2c_deadline_start(&deadline, WIRE_I2C_FLAG_TIMEOUT_START);
     do {
         stat0 = I2C_STAT0(obj->i2c);
         if (stat0 & (I2C_STAT0_LOSTARB | I2C_STAT0_BERR | I2C_STAT0_SBSEND)) {
             break;
         }
-    } while (--timeout != 0);
+        expired = i2c_deadline_expired(&deadline);
+    } while (!expired);
     if (stat0 & I2C_STAT0_SBSEND) {
         /*
          * Don't clear any flags, because that disrupts the automatic
@@ -282,10 +468,11 @@ static i2c_status_enum i2c_start(i2c_t *obj)
     }
     /* Clear any error flags that were set */
     I2C_STAT0(obj->i2c) = stat0 & ~(I2C_STAT0_AERR | I2C_STAT0_LOSTARB | I2C_STAT0_BERR);
+    i2c_stats_errors(obj, stat0);
     if (stat0 & (I2C_STAT0_LOSTARB | I2C_STAT0_BERR)) {
         ret = I2C_ERROR;
     }
-    if (0 == timeout) {
+    if (expired) {
         stat1 = I2C_STAT1(obj->i2c);
         if ((stat1 & (I2C_STAT1_I2CBSY | I2C_STAT1_MASTER)) == I2C_STAT1_I2CBSY) {
             ret = I2C_BUSY;
@@ -297,6 +484,17 @@ static i2c_status_enum i2c_start(i2c_t *obj)
     return ret;
 }
 
+/** Give the event interrupts back to the slave side once the bus is let go
+ *
+ * @param obj_s The I2C object
+ */
+static void i2c_slave_irq_resume(struct i2c_s *obj_s)
+{
+    if (obj_s->slave_irq) {
+        I2C_CTL1(obj_s->i2c) |= I2C_CTL1_ERRIE | I2C_CTL1_EVIE | I2C_CTL1_BUFIE;
+    }
+}
+
 /** Send STOP command
  *
  * @param obj The I2C object
@@ -308,15 +506,17 @@ i2c_status_enum  i2c_stop(i2c_t *obj)
 
     /* generate a STOP condition */
     i2c_stop_on_bus(obj_s->i2c);
+    i2c_slave_irq_resume(obj_s);
     /* If we don't own the bus (lost arbitration, etc), don't wait */
     if (!own_bus) {
         return I2C_OK;
     }
 
     /* wait for STOP bit reset with timeout */
-    int timeout = WIRE_I2C_FLAG_TIMEOUT_STOP_BIT_RESET;
+    i2c_deadline_t deadline;
+    i2c_deadline_start(&deadline, WIRE_I2C_FLAG_TIMEOUT_STOP_BIT_RESET);
     while ((I2C_CTL0(obj_s->i2c) & I2C_CTL0_STOP)) {
-        if ((timeout--) == 0) {
+        if (i2c_deadline_expired(&deadline)) {
             return I2C_TIMEOUT;
         }
     }
@@ -352,29 +552,34 @@ static i2c_status_enum i2c_wait_addr(i2c_t *obj)
  * @param data    The buffer for sending
  * @param length  Number of bytes to write
  * @param stop    Stop to be generated after the transfer is done
- * @return Status
+ * @return Status, I2C_BUSY while another transfer has the peripheral
  */
 i2c_status_enum i2c_master_transmit(i2c_t *obj, uint8_t address, uint8_t *data, uint16_t length,
                                     uint8_t stop)
 {
-
+    uint32_t start_us = getCurrentMicros();
+    i2c_status_enum ret = I2C_OK;
+    uint32_t count = 0;
 
     /* When size is 0, this is usually an I2C scan / ping to check if device is there and ready */
     if (length == 0) {
-        return i2c_wait_standby_state(obj, address);
+        ret = i2c_wait_standby_state(obj, address);
+        i2c_stats_record(obj, ret, 0, start_us);
+        return ret;
     }
 
-    if (length > I2C_BUFFER_SIZE) {
-        return I2C_DATA_TOO_LONG;
+    if ((length >= WIRE_I2C_DMA_THRESHOLD) && i2c_master_can_wait()) {
+        return i2c_master_transfer_wait(obj, address, I2C_TRANSMITTER, data, length, stop);
+    }
+    if (!i2c_master_claim(obj)) {
+        return I2C_BUSY;
     }
-
-    i2c_status_enum ret = I2C_OK;
-    uint32_t timeout = 0;
-    uint32_t count = 0;
 
     /* Don't wait on BUSY; peripheral does that before sending START */
     ret = i2c_start(obj);
     if (I2C_OK != ret) {
+        obj->polled = false;
+        i2c_stats_record(obj, ret, 0, start_us);
         return ret;
     }
 
@@ -393,7 +598,12 @@ i2c_status_enum i2c_master_transmit(i2c_t *obj, uint8_t address, uint8_t *data,
     /* if not sequential write, then send stop */
     if (stop) {
         i2c_stop(obj);
+    } else if (I2C_OK == ret) {
+        /* as in i2c_master_finish(), the held bus leaves BTC set */
+        I2C_CTL1(obj->i2c) &= ~(I2C_CTL1_EVIE | I2C_CTL1_BUFIE);
     }
+    obj->polled = false;
+    i2c_stats_record(obj, ret, (I2C_OK == ret) ? length : count, start_us);
     return ret;
 }
 
@@ -416,9 +626,10 @@ static int i2c_byte_read(i2c_t *obj, int last)
     }
 
     /* wait until the byte is received */
-    uint32_t timeout = WIRE_I2C_FLAG_TIMEOUT_BYTE_RECEIVED;
+    i2c_deadline_t deadline;
+    i2c_deadline_start(&deadline, WIRE_I2C_FLAG_TIMEOUT_BYTE_RECEIVED);
     while ((i2c_flag_get(obj_s->i2c, I2C_FLAG_RBNE)) == RESET) {
-        if ((timeout--) == 0) {
+        if (i2c_deadline_expired(&deadline)) {
             return -1;
         }
     }
@@ -432,7 +643,7 @@ static int i2c_byte_read(i2c_t *obj, int last)
  * @param data    The buffer for receiving
  * @param length  Number of bytes to read
  * @param stop    Stop to be generated after the transfer is done
- * @return status
+ * @return status, I2C_BUSY while another transfer has the peripheral
  */
 /*
  * This contains a workaround for a hardware erratum:
@@ -462,9 +673,17 @@ static int i2c_byte_read(i2c_t *obj, int last)
 i2c_status_enum i2c_master_receive(i2c_t *obj, uint8_t address, uint8_t *data, uint16_t length,
                                    int stop)
 {
+    uint32_t start_us = getCurrentMicros();
     i2c_status_enum ret = I2C_OK;
     uint32_t count = 0;
 
+    if ((length >= WIRE_I2C_DMA_THRESHOLD) && i2c_master_can_wait()) {
+        return i2c_master_transfer_wait(obj, address, I2C_RECEIVER, data, length, stop);
+    }
+    if (!i2c_master_claim(obj)) {
+        return I2C_BUSY;
+    }
+
     if (1 == length) {
         /* Reset ACK control to current byte */
         i2c_ackpos_config(obj->i2c, I2C_ACKPOS_CURRENT);
@@ -484,6 +703,8 @@ i2c_status_enum i2c_master_receive(i2c_t *obj, uint8_t address, uint8_t *data, u
     }
     ret = i2c_start(obj);
     if (I2C_OK != ret) {
+        obj->polled = false;
+        i2c_stats_record(obj, ret, 0, start_us);
         return ret;
     }
     /* send slave address */
@@ -519,6 +740,8 @@ i2c_status_enum i2c_master_receive(i2c_t *obj, uint8_t address, uint8_t *data, u
     if (stop) {
         i2c_stop(obj);
     }
+    obj->polled = false;
+    i2c_stats_record(obj, ret, count, start_us);
     return ret;
 }
 
@@ -532,9 +755,13 @@ i2c_status_enum i2c_wait_standby_state(i2c_t *obj, uint8_t address)
 {
     i2c_status_enum status = I2C_OK;
 
+    if (!i2c_master_claim(obj)) {
+        return I2C_BUSY;
+    }
     /* Don't wait on BUSY; peripheral does that before sending START */
     status = i2c_start(obj);
     if (I2C_OK != status) {
+        obj->polled = false;
         return status;
     }
 
@@ -543,17 +770,601 @@ i2c_status_enum i2c_wait_standby_state(i2c_t *obj, uint8_t address)
     status = i2c_wait_addr(obj);
     // On failure to send a stop, return the timeout
     if (i2c_stop(obj) != I2C_OK) {
-        return I2C_TIMEOUT;
+        status = I2C_TIMEOUT;
     }
+    obj->polled = false;
     return status;
 }
 
+static void i2c_queue_next(struct i2c_s *obj_s, i2c_status_enum status);
+
+/** End an interrupt-driven transfer
+ *
+ * Called from the I2C interrupt, or with it masked.
+ *
+ * @param obj_s  The I2C object
+ * @param status How the transfer ended
+ */
+static void i2c_master_finish(struct i2c_s *obj_s, i2c_status_enum status)
+{
+    if (obj_s->xfer_dma) {
+        I2C_CTL1(obj_s->i2c) &= ~(I2C_CTL1_DMAON | I2C_CTL1_DMALST);
+#if defined(GD32F30x) || defined(GD32E50X)
+        dma_channel_release(i2c_dma[obj_s->index].dma,
+                            (I2C_RECEIVER == obj_s->xfer_direction) ? i2c_dma[obj_s->index].rx : i2c_dma[obj_s->index].tx);
+#endif
+        obj_s->xfer_dma = false;
+    }
+    if (obj_s->slave_irq && ((I2C_OK != status) || obj_s->xfer_stop)) {
+        /* back to serving the slave side */
+        I2C_CTL1(obj_s->i2c) |= I2C_CTL1_ERRIE | I2C_CTL1_EVIE | I2C_CTL1_BUFIE;
+    } else {
+        /* a write without STOP keeps the bus with BTC set, which the slave
+           side can't clear: its events wait for the STOP or the next START */
+        I2C_CTL1(obj_s->i2c) &= ~(I2C_CTL1_EVIE | I2C_CTL1_BUFIE);
+        if (!obj_s->slave_irq) {
+            I2C_CTL1(obj_s->i2c) &= ~I2C_CTL1_ERRIE;
+        }
+    }
+    i2c_ackpos_config(obj_s->i2c, I2C_ACKPOS_CURRENT);
+    i2c_ack_config(obj_s->i2c, I2C_ACK_ENABLE);
+    i2c_stats_record(obj_s, status, obj_s->xfer_count, obj_s->xfer_start_us);
+    obj_s->xfer_status = status;
+    obj_s->xfer_state = I2C_XFER_IDLE;
+    if (obj_s->queue_ops != NULL) {
+        i2c_queue_next(obj_s, status);
+        return;
+    }
+    /* a blocking call's caller gets the status itself */
+    if ((obj_s->master_callback != NULL) && !obj_s->xfer_blocking) {
+        obj_s->master_callback(obj_s->master_callback_param, status);
+    }
+}
+
+/** Start an interrupt-driven master transfer
+ *
+ * The ACK setup for short reads is the same as in i2c_master_receive().
+ */
+static i2c_status_enum i2c_master_start_it(struct i2c_s *obj_s, uint8_t address, uint32_t direction,
+                                           uint8_t *data, uint16_t length, uint8_t stop,
+                                           bool blocking)
+{
+    i2c_deadline_t deadline;
+    uint32_t stop_us = WIRE_I2C_FLAG_TIMEOUT_STOP_BIT_RESET;
+    bool from_irq = (0 != __get_IPSR());
+
+    if ((I2C_XFER_IDLE != obj_s->xfer_state) || obj_s->polled) {
+        return I2C_BUSY;
+    }
+    /*
+     * The STOP that ended the last transfer has to be out before the next
+     * START. From the I2C interrupt, where the queue chains its transfers,
+     * that is only waited for about two SCL periods, as long as a STOP
+     * takes on a free bus: a target stretching the clock beyond that fails
+     * the start with I2C_BUSY instead of stalling the interrupt.
+     */
+    if (from_irq) {
+        uint32_t scl_hz = obj_s->scl_hz ? obj_s->scl_hz : I2C_CLOCK_SM;
+        stop_us = (2000000U + scl_hz - 1) / scl_hz;
+        if (stop_us > WIRE_I2C_FLAG_TIMEOUT_STOP_BIT_RESET) {
+            stop_us = WIRE_I2C_FLAG_TIMEOUT_STOP_BIT_RESET;
+        }
+    }
+    i2c_deadline_start(&deadline, stop_us);
+    while (I2C_CTL0(obj_s->i2c) & I2C_CTL0_STOP) {
+        if (i2c_deadline_expired(&deadline)) {
+            return from_irq ? I2C_BUSY : I2C_TIMEOUT;
+        }
+    }
+
+    obj_s->xfer_address = address;
+    obj_s->xfer_direction = direction;
+    obj_s->xfer_stop = stop;
+    obj_s->xfer_ptr = data;
+    obj_s->xfer_length = length;
+    obj_s->xfer_count = 0;
+    obj_s->xfer_dma = false;
+    obj_s->xfer_blocking = blocking;
+    obj_s->xfer_start_us = getCurrentMicros();
+    obj_s->xfer_status = I2C_BUSY;
+    obj_s->xfer_state = I2C_XFER_START;
+
+    if ((I2C_RECEIVER == direction) && (2 == length)) {
+        /* send a NACK for the next data byte which will be received into the shift register */
+        i2c_ackpos_config(obj_s->i2c, I2C_ACKPOS_NEXT);
+        i2c_ack_config(obj_s->i2c, I2C_ACK_DISABLE);
+    } else if ((I2C_RECEIVER == direction) && (1 == length)) {
+        i2c_ackpos_config(obj_s->i2c, I2C_ACKPOS_CURRENT);
+        i2c_ack_config(obj_s->i2c, I2C_ACK_DISABLE);
+    } else {
+        i2c_ackpos_config(obj_s->i2c, I2C_ACKPOS_CURRENT);
+        i2c_ack_config(obj_s->i2c, I2C_ACK_ENABLE);
+    }
+
+    i2c_irq_enable(obj_s);
+    /* no buffer interrupts until the address is out */
+    I2C_CTL1(obj_s->i2c) = (I2C_CTL1(obj_s->i2c) & ~I2C_CTL1_BUFIE) | I2C_CTL1_ERRIE | I2C_CTL1_EVIE;
+    i2c_start_on_bus(obj_s->i2c);
+    return I2C_OK;
+}
+
+#if defined(GD32F30x) || defined(GD32E50X)
+/** End of a DMA data phase
+ *
+ * A write still has to wait for BTC on its last byte, so the event
+ * interrupt comes back on; DMALST has already made the peripheral NACK the
+ * last byte of a read, which only needs its STOP.
+ */
+static void i2c_master_dma_callback(void *param, uint32_t events)
+{
+    struct i2c_s *obj_s = (struct i2c_s *)param;
+    uint32_t i2c = obj_s->i2c;
+
+    I2C_CTL1(i2c) &= ~(I2C_CTL1_DMAON | I2C_CTL1_DMALST);
+    if (events & DMA_EVENT_ERROR) {
+        i2c_stop_on_bus(i2c);
+        i2c_master_finish(obj_s, I2C_ERROR);
+        return;
+    }
+    obj_s->xfer_count = obj_s->xfer_length;
+    if (I2C_RECEIVER == obj_s->xfer_direction) {
+        if (obj_s->xfer_stop) {
+            i2c_stop_on_bus(i2c);
+        }
+        i2c_master_finish(obj_s, I2C_OK);
+    } else {
+        I2C_CTL1(i2c) |= I2C_CTL1_EVIE;
+    }
+}
+#endif
+
+/** Hand the data phase of a transfer to DMA
+ *
+ * Called on ADDSEND, before it is cleared.
+ *
+ * @param obj_s The I2C object
+ * @return whether DMA took over; if not the interrupt engine carries on
+ */
+static bool i2c_master_dma_start(struct i2c_s *obj_s)
+{
+#if defined(GD32F30x) || defined(GD32E50X)
+    uint32_t i2c = obj_s->i2c;
+    bool rx = (I2C_RECEIVER == obj_s->xfer_direction);
+    const i2c_dma_t *dma = &i2c_dma[obj_s->index];
+    dma_channel_enum channel = rx ? dma->rx : dma->tx;
+    dma_parameter_struct dma_init_struct;
+
+    if ((obj_s->xfer_length < WIRE_I2C_DMA_THRESHOLD) || (obj_s->xfer_length < 3) ||
+        !dma_channel_claim(dma->dma, channel, i2c_master_dma_callback, obj_s)) {
+        return false;
+    }
+    dma_struct_para_init(&dma_init_struct);
+    dma_init_struct.direction = rx ? DMA_PERIPHERAL_TO_MEMORY : DMA_MEMORY_TO_PERIPHERAL;
+    dma_init_struct.memory_addr = (uint32_t)obj_s->xfer_ptr;
+    dma_init_struct.memory_inc = DMA_MEMORY_INCREASE_ENABLE;
+    dma_init_struct.memory_width = DMA_MEMORY_WIDTH_8BIT;
+    dma_init_struct.number = obj_s->xfer_length;
+    dma_init_struct.periph_addr = (uint32_t)&I2C_DATA(i2c);
+    dma_init_struct.periph_inc = DMA_PERIPH_INCREASE_DISABLE;
+    dma_init_struct.periph_width = DMA_PERIPHERAL_WIDTH_8BIT;
+    dma_init_struct.priority = DMA_PRIORITY_HIGH;
+    dma_channel_start(dma->dma, channel, &dma_init_struct, DMA_EVENT_FULL_TRANSFER | DMA_EVENT_ERROR,
+                      false);
+    obj_s->xfer_dma = true;
+
+    /* events stay quiet until the DMA is done; errors still come in */
+    I2C_CTL1(i2c) &= ~(I2C_CTL1_EVIE | I2C_CTL1_BUFIE);
+    if (rx) {
+        I2C_CTL1(i2c) |= I2C_CTL1_DMALST;
+    }
+    I2C_CTL1(i2c) |= I2C_CTL1_DMAON;
+    return true;
+#else
+    (void)obj_s;
+    return false;
+#endif
+}
+
+/** Master side of the event interrupt
+ *
+ * Reads are done on BTC rather than RBNE whenever two or more bytes are
+ * left, for the same erratum as in i2c_master_receive(): the last two bytes
+ * of a read both come in on one BTC, after STOP has been requested.
+ *
+ * @param obj_s The I2C object
+ */
+static void i2c_master_irq(struct i2c_s *obj_s)
+{
+    uint32_t i2c = obj_s->i2c;
+    uint32_t stat0 = I2C_STAT0(i2c);
+    uint16_t remaining;
+
+    switch (obj_s->xfer_state) {
+        case I2C_XFER_START:
+            if (stat0 & I2C_STAT0_SBSEND) {
+                obj_s->xfer_state = I2C_XFER_ADDR;
+                i2c_master_addressing(i2c, obj_s->xfer_address, obj_s->xfer_direction);
+            }
+            break;
+        case I2C_XFER_ADDR:
+            if (!(stat0 & I2C_STAT0_ADDSEND)) {
+                break;
+            }
+            if (I2C_RECEIVER == obj_s->xfer_direction) {
+                obj_s->xfer_state = I2C_XFER_RX;
+                if (i2c_master_dma_start(obj_s)) {
+                    (void)I2C_STAT1(i2c);
+                    break;
+                }
+                /* clear ADDSEND */
+                (void)I2C_STAT1(i2c);
+                if (1 == obj_s->xfer_length) {
+                    if (obj_s->xfer_stop) {
+                        i2c_stop_on_bus(i2c);
+                    }
+                    I2C_CTL1(i2c) |= I2C_CTL1_BUFIE;
+                }
+            } else {
+                (void)I2C_STAT1(i2c);
+                if (0 == obj_s->xfer_length) {
+                    /* address probe */
+                    if (obj_s->xfer_stop) {
+                        i2c_stop_on_bus(i2c);
+                    }
+                    i2c_master_finish(obj_s, I2C_OK);
+                    break;
+                }
+                obj_s->xfer_state = I2C_XFER_TX;
+                if (i2c_master_dma_start(obj_s)) {
+                    break;
+                }
+                I2C_DATA(i2c) = obj_s->xfer_ptr[obj_s->xfer_count++];
+                if (obj_s->xfer_count < obj_s->xfer_length) {
+                    I2C_CTL1(i2c) |= I2C_CTL1_BUFIE;
+                }
+            }
+            break;
+        case I2C_XFER_TX:
+            if (obj_s->xfer_count < obj_s->xfer_length) {
+                if (stat0 & I2C_STAT0_TBE) {
+                    I2C_DATA(i2c) = obj_s->xfer_ptr[obj_s->xfer_count++];
+                    if (obj_s->xfer_count == obj_s->xfer_length) {
+                        /* wait for the last byte to be acknowledged */
+                        I2C_CTL1(i2c) &= ~I2C_CTL1_BUFIE;
+                    }
+                }
+            } else if (stat0 & I2C_STAT0_BTC) {
+                if (obj_s->xfer_stop) {
+                    i2c_stop_on_bus(i2c);
+                }
+                i2c_master_finish(obj_s, I2C_OK);
+            }
+            break;
+        case I2C_XFER_RX:
+            remaining = obj_s->xfer_length - obj_s->xfer_count;
+            if (1 == remaining) {
+                if (stat0 & I2C_STAT0_RBNE) {
+                    obj_s->xfer_ptr[obj_s->xfer_count++] = I2C_DATA(i2c);
+                    i2c_master_finish(obj_s, I2C_OK);
+                }
+            } else if (stat0 & I2C_STAT0_BTC) {
+                if (2 == remaining) {
+                    if (obj_s->xfer_stop) {
+                        i2c_stop_on_bus(i2c);
+                    }
+                    obj_s->xfer_ptr[obj_s->xfer_count++] = I2C_DATA(i2c);
+                    obj_s->xfer_ptr[obj_s->xfer_count++] = I2C_DATA(i2c);
+                    i2c_master_finish(obj_s, I2C_OK);
+                } else {
+                    if (3 == remaining) {
+                        /* NACK the last byte */
+                        i2c_ack_config(i2c, I2C_ACK_DISABLE);
+                    }
+                    obj_s->xfer_ptr[obj_s->xfer_count++] = I2C_DATA(i2c);
+                }
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/** Master side of the error interrupt
+ *
+ * @param obj_s The I2C object
+ */
+static void i2c_master_error_irq(struct i2c_s *obj_s)
+{
+    uint32_t i2c = obj_s->i2c;
+    uint32_t stat0 = I2C_STAT0(i2c);
+    i2c_status_enum status = I2C_ERROR;
+
+    /* Clear the error flags */
+    I2C_STAT0(i2c) = stat0 & ~(I2C_STAT0_AERR | I2C_STAT0_LOSTARB | I2C_STAT0_BERR | I2C_STAT0_OUERR);
+    if (stat0 & I2C_STAT0_AERR) {
+        status = (I2C_XFER_ADDR == obj_s->xfer_state) ? I2C_NACK_ADDR : I2C_NACK_DATA;
+        i2c_stop_on_bus(i2c);
+    }
+    /* Hard errors take priority over NACK; after losing arbitration the bus isn't ours to STOP */
+    if (stat0 & (I2C_STAT0_LOSTARB | I2C_STAT0_BERR)) {
+        status = I2C_ERROR;
+    }
+    i2c_stats_errors(obj_s, stat0);
+    if (stat0 & (I2C_STAT0_AERR | I2C_STAT0_LOSTARB | I2C_STAT0_BERR | I2C_STAT0_OUERR)) {
+        i2c_master_finish(obj_s, status);
+    }
+}
+
+/** Start the first transfer of a queued transaction
+ *
+ * Writes end in a repeated START when more transactions follow. Reads
+ * always end in a STOP, since that has to be requested before their last
+ * byte is in.
+ */
+static i2c_status_enum i2c_queue_start(struct i2c_s *obj_s)
+{
+    i2c_op_t *op = &obj_s->queue_ops[obj_s->queue_index];
+    bool last = (obj_s->queue_index + 1 == obj_s->queue_count);
+
+    obj_s->queue_phase = 0;
+    switch (op->type) {
+        case I2C_OP_WRITE:
+            return i2c_master_start_it(obj_s, op->address << 1, I2C_TRANSMITTER, op->tx, op->tx_length,
+                                       last, false);
+        case I2C_OP_READ:
+            if (0 == op->rx_length) {
+                return I2C_DATA_TOO_LONG;
+            }
+            return i2c_master_start_it(obj_s, op->address << 1, I2C_RECEIVER, op->rx, op->rx_length, 1,
+                                       false);
+        case I2C_OP_WRITE_READ:
+            if (0 == op->rx_length) {
+                return I2C_DATA_TOO_LONG;
+            }
+            return i2c_master_start_it(obj_s, op->address << 1, I2C_TRANSMITTER, op->tx, op->tx_length,
+                                       0, false);
+        default:
+            return I2C_ERROR;
+    }
+}
+
+/** Record how a queued transfer ended and start the next one
+ *
+ * Runs from the I2C interrupt, through i2c_master_finish(). A failed
+ * transaction doesn't stop the queue: the next one addresses its device
+ * afresh.
+ */
+static void i2c_queue_next(struct i2c_s *obj_s, i2c_status_enum status)
+{
+    i2c_op_t *op = &obj_s->queue_ops[obj_s->queue_index];
+
+    if ((I2C_OP_WRITE_READ == op->type) && (0 == obj_s->queue_phase) && (I2C_OK == status)) {
+        obj_s->queue_phase = 1;
+        status = i2c_master_start_it(obj_s, op->address << 1, I2C_RECEIVER, op->rx, op->rx_length, 1,
+                                     false);
+        if (I2C_OK == status) {
+            return;
+        }
+    }
+    op->status = status;
+    while (++obj_s->queue_index < obj_s->queue_count) {
+        op = &obj_s->queue_ops[obj_s->queue_index];
+        status = i2c_queue_start(obj_s);
+        if (I2C_OK == status) {
+            return;
+        }
+        op->status = status;
+    }
+    /* a write meant to be followed by a repeated START may still hold the bus */
+    if (I2C_STAT1(obj_s->i2c) & I2C_STAT1_MASTER) {
+        i2c_stop_on_bus(obj_s->i2c);
+    }
+    i2c_slave_irq_resume(obj_s);
+    obj_s->queue_ops = NULL;
+    if (obj_s->queue_callback != NULL) {
+        obj_s->queue_callback(obj_s->queue_callback_param);
+    }
+}
+
+/** Run a list of transactions back to back from the I2C interrupt
+ *
+ * Returns at once. Each transaction's status is I2C_BUSY until it has run;
+ * the callback is called once, from the I2C interrupt, after the last one.
+ * The list and the buffers it points to must stay valid until then.
+ *
+ * @param obj      The I2C object
+ * @param ops      The transactions
+ * @param count    Number of transactions
+ * @param callback Called when all are done, or NULL
+ * @param param    Passed back to the callback
+ * @return I2C_OK if the queue was started, I2C_BUSY if a transfer is running
+ */
+i2c_status_enum i2c_master_queue(i2c_t *obj, i2c_op_t *ops, uint16_t count,
+                                 void (*callback)(void *), void *param)
+{
+    struct i2c_s *obj_s = I2C_S(obj);
+    i2c_status_enum ret = I2C_OK;
+    uint16_t i;
+
+    if ((0 == count) || (NULL == ops)) {
+        return I2C_ERROR;
+    }
+    if (i2c_master_busy(obj)) {
+        return I2C_BUSY;
+    }
+    for (i = 0; i < count; i++) {
+        ops[i].status = I2C_BUSY;
+    }
+    obj_s->queue_count = count;
+    obj_s->queue_index = 0;
+    obj_s->queue_callback = callback;
+    obj_s->queue_callback_param = param;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    obj_s->queue_ops = ops;
+    while (obj_s->queue_index < count) {
+        ret = i2c_queue_start(obj_s);
+        if (I2C_OK == ret) {
+            break;
+        }
+        ops[obj_s->queue_index++].status = ret;
+    }
+    if (obj_s->queue_index == count) {
+        /* nothing could be started */
+        obj_s->queue_ops = NULL;
+        __set_PRIMASK(primask);
+        if (callback != NULL) {
+            callback(param);
+        }
+        return ret;
+    }
+    __set_PRIMASK(primask);
+    return I2C_OK;
+}
+
+/** Run a long blocking transfer through the interrupt engine
+ *
+ * So it gets DMA when the channel is free. Only usable when the I2C
+ * interrupts can preempt the caller, see i2c_master_can_wait().
+ *
+ * @return the transfer's status, I2C_BUSY if the bus never became free
+ */
+static i2c_status_enum i2c_master_transfer_wait(struct i2c_s *obj_s, uint8_t address,
+                                                uint32_t direction, uint8_t *data,
+                                                uint16_t length, uint8_t stop)
+{
+    i2c_status_enum ret;
+    i2c_deadline_t deadline;
+
+    ret = i2c_master_start_it(obj_s, address, direction, data, length, stop, true);
+    if (I2C_OK != ret) {
+        return ret;
+    }
+    i2c_deadline_start(&deadline, WIRE_I2C_ACK_TIMEOUT * ((uint32_t)length + 2));
+    while (i2c_master_busy(obj_s)) {
+        if (i2c_deadline_expired(&deadline)) {
+            uint32_t stat1 = I2C_STAT1(obj_s->i2c);
+            if ((I2C_XFER_START == obj_s->xfer_state) &&
+                ((stat1 & (I2C_STAT1_I2CBSY | I2C_STAT1_MASTER)) == I2C_STAT1_I2CBSY)) {
+                ret = I2C_BUSY;
+            } else {
+                ret = I2C_TIMEOUT;
+            }
+            i2c_master_abort(obj_s, ret);
+        }
+    }
+    return i2c_master_status(obj_s);
+}
+
+/** Start writing bytes at a given address, from the I2C interrupt
+ *
+ * Returns at once. Completion is reported through i2c_master_busy(),
+ * i2c_master_status() and the callback set with i2c_attach_master_callback();
+ * data must stay valid until then.
+ *
+ * @param obj     The I2C object
+ * @param address 7-bit address (last bit is 0)
+ * @param data    The buffer for sending
+ * @param length  Number of bytes to write, 0 to probe the address
+ * @param stop    Stop to be generated after the transfer is done
+ * @return I2C_OK if the transfer was started, I2C_BUSY if one is running
+ */
+i2c_status_enum i2c_master_transmit_it(i2c_t *obj, uint8_t address, uint8_t *data, uint16_t length,
+                                       uint8_t stop)
+{
+    return i2c_master_start_it(I2C_S(obj), address, I2C_TRANSMITTER, data, length, stop, false);
+}
+
+/** Start reading bytes from a given address, from the I2C interrupt
+ *
+ * @param obj     The I2C object
+ * @param address 7-bit address (last bit is 1)
+ * @param data    The buffer for receiving
+ * @param length  Number of bytes to read
+ * @param stop    Stop to be generated after the transfer is done
+ * @return I2C_OK if the transfer was started, I2C_BUSY if one is running
+ */
+i2c_status_enum i2c_master_receive_it(i2c_t *obj, uint8_t address, uint8_t *data, uint16_t length,
+                                      uint8_t stop)
+{
+    if (0 == length) {
+        return I2C_DATA_TOO_LONG;
+    }
+    return i2c_master_start_it(I2C_S(obj), address, I2C_RECEIVER, data, length, stop, false);
+}
+
+/** Whether an interrupt-driven or polled transfer is still running
+ *
+ * @param obj The I2C object
+ */
+bool i2c_master_busy(i2c_t *obj)
+{
+    return (I2C_XFER_IDLE != obj->xfer_state) || (NULL != obj->queue_ops) || obj->polled;
+}
+
+/** Result of the last interrupt-driven transfer
+ *
+ * @param obj The I2C object
+ * @return I2C_BUSY while it is running
+ */
+i2c_status_enum i2c_master_status(i2c_t *obj)
+{
+    return obj->xfer_status;
+}
+
+/** Give up on a running interrupt-driven transfer
+ *
+ * Sends a STOP if we still own the bus and completes the transfer with the
+ * given status.
+ *
+ * @param obj    The I2C object
+ * @param status Status to complete with
+ */
+void i2c_master_abort(i2c_t *obj, i2c_status_enum status)
+{
+    struct i2c_s *obj_s = I2C_S(obj);
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (I2C_XFER_IDLE != obj_s->xfer_state) {
+        if (I2C_STAT1(obj_s->i2c) & I2C_STAT1_MASTER) {
+            i2c_stop_on_bus(obj_s->i2c);
+        }
+        if (obj_s->queue_ops != NULL) {
+            /* the rest of the queue doesn't run either */
+            while (obj_s->queue_index + 1 < obj_s->queue_count) {
+                obj_s->queue_ops[--obj_s->queue_count].status = status;
+            }
+            obj_s->queue_phase = 1;
+        }
+        i2c_master_finish(obj_s, status);
+    }
+    __set_PRIMASK(primask);
+}
+
+/** sets function called from the I2C interrupt when a transfer ends
+ *
+ * @param obj      The I2C object
+ * @param function Callback function to use, NULL for none
+ * @param param    Passed back to the callback
+ */
+void i2c_attach_master_callback(i2c_t *obj, void (*function)(void *, i2c_status_enum), void *param)
+{
+    if (obj == NULL) {
+        return;
+    }
+    obj->master_callback = function;
+    obj->master_callback_param = param;
+}
+
 /** sets function called before a slave read operation
  *
  * @param obj      The I2C object
  * @param function Callback function to use
+ * @param param    Passed back to the slave callbacks
  */
-void i2c_attach_slave_rx_callback(i2c_t *obj, void (*function)(uint8_t *, int))
+void i2c_attach_slave_rx_callback(i2c_t *obj, void (*function)(void *, uint8_t *, int), void *param)
 {
     if (obj == NULL) {
         return;
@@ -563,14 +1374,16 @@ void i2c_attach_slave_rx_callback(i2c_t *obj, void (*function)(uint8_t *, int))
         return;
     }
     obj->slave_receive_callback = function;
+    obj->slave_callback_param = param;
 }
 
 /** sets function called before a slave write operation
  *
  * @param obj      The I2C object
  * @param function Callback function to use
+ * @param param    Passed back to the slave callbacks
  */
-void i2c_attach_slave_tx_callback(i2c_t *obj, void (*function)(void))
+void i2c_attach_slave_tx_callback(i2c_t *obj, void (*function)(void *), void *param)
 {
     if (obj == NULL) {
         return;
@@ -580,6 +1393,7 @@ void i2c_attach_slave_tx_callback(i2c_t *obj, void (*function)(void))
         return;
     }
     obj->slave_transmit_callback = function;
+    obj->slave_callback_param = param;
 }
 
 /** Write bytes to master
@@ -592,10 +1406,10 @@ void i2c_attach_slave_tx_callback(i2c_t *obj, void (*function)(void))
 i2c_status_enum i2c_slave_write_buffer(i2c_t *obj, uint8_t *data, uint16_t length)
 {
     struct i2c_s *obj_s = I2C_S(obj);
-    uint8_t i = 0;
+    uint16_t i = 0;
     i2c_status_enum ret = I2C_OK;
 
-    if (length > I2C_BUFFER_SIZE) {
+    if (length > obj_s->tx_size) {
         ret = I2C_DATA_TOO_LONG;
     } else {
         /* check the communication status */
@@ -609,90 +1423,330 @@ i2c_status_enum i2c_slave_write_buffer(i2c_t *obj, uint8_t *data, uint16_t lengt
 }
 
 
-#ifdef I2C0
+/** Bytes moved by the current register file data phase */
+static uint16_t i2c_regfile_moved(struct i2c_s *obj_s)
+{
+    uint16_t count = obj_s->regfile_count;
+
+#if defined(GD32F30x) || defined(GD32E50X)
+    if (obj_s->regfile_dma) {
+        const i2c_dma_t *dma = &i2c_dma[obj_s->index];
+        dma_channel_enum channel = (I2C_REGFILE_READ == obj_s->regfile_phase) ? dma->tx : dma->rx;
+        count += obj_s->regfile_dma_length - dma_channel_remaining(dma->dma, channel);
+    }
+#endif
+    return count;
+}
+
+static void i2c_regfile_dma_stop(struct i2c_s *obj_s)
+{
+#if defined(GD32F30x) || defined(GD32E50X)
+    if (obj_s->regfile_dma) {
+        const i2c_dma_t *dma = &i2c_dma[obj_s->index];
+
+        I2C_CTL1(obj_s->i2c) &= ~I2C_CTL1_DMAON;
+        dma_channel_release(dma->dma,
+                            (I2C_REGFILE_READ == obj_s->regfile_phase) ? dma->tx : dma->rx);
+        obj_s->regfile_dma = false;
+        I2C_CTL1(obj_s->i2c) |= I2C_CTL1_BUFIE;
+    }
+#else
+    (void)obj_s;
+#endif
+}
+
+#if defined(GD32F30x) || defined(GD32E50X)
+/* point the data phase's DMA at the register the next byte goes to */
+static void i2c_regfile_dma_arm(struct i2c_s *obj_s)
+{
+    const i2c_dma_t *dma = &i2c_dma[obj_s->index];
+    bool tx = (I2C_REGFILE_READ == obj_s->regfile_phase);
+    uint16_t first = (obj_s->regfile_start + obj_s->regfile_count) % obj_s->regfile_size;
+    dma_parameter_struct dma_init_struct;
+
+    dma_struct_para_init(&dma_init_struct);
+    dma_init_struct.direction = tx ? DMA_MEMORY_TO_PERIPHERAL : DMA_PERIPHERAL_TO_MEMORY;
+    dma_init_struct.memory_addr = (uint32_t)&obj_s->regfile[first];
+    dma_init_struct.memory_inc = DMA_MEMORY_INCREASE_ENABLE;
+    dma_init_struct.memory_width = DMA_MEMORY_WIDTH_8BIT;
+    dma_init_struct.number = obj_s->regfile_size - first;
+    dma_init_struct.periph_addr = (uint32_t)&I2C_DATA(obj_s->i2c);
+    dma_init_struct.periph_inc = DMA_PERIPH_INCREASE_DISABLE;
+    dma_init_struct.periph_width = DMA_PERIPHERAL_WIDTH_8BIT;
+    dma_init_struct.priority = DMA_PRIORITY_HIGH;
+    obj_s->regfile_dma_length = dma_init_struct.number;
+    dma_channel_start(dma->dma, tx ? dma->tx : dma->rx, &dma_init_struct,
+                      DMA_EVENT_FULL_TRANSFER | DMA_EVENT_ERROR, false);
+}
+
+/* the end of the file was reached: wrap around, or give up on DMA */
+static void i2c_regfile_dma_callback(void *param, uint32_t events)
+{
+    struct i2c_s *obj_s = (struct i2c_s *)param;
+
+    if (events & DMA_EVENT_ERROR) {
+        obj_s->regfile_count = i2c_regfile_moved(obj_s);
+        i2c_regfile_dma_stop(obj_s);
+        return;
+    }
+    obj_s->regfile_count += obj_s->regfile_dma_length;
+    i2c_regfile_dma_arm(obj_s);
+}
+#endif
+
+/* hand a data phase to DMA if its channel is free */
+static void i2c_regfile_dma_start(struct i2c_s *obj_s)
+{
+#if defined(GD32F30x) || defined(GD32E50X)
+    const i2c_dma_t *dma = &i2c_dma[obj_s->index];
+    dma_channel_enum channel = (I2C_REGFILE_READ == obj_s->regfile_phase) ? dma->tx : dma->rx;
+
+    if (!dma_channel_claim(dma->dma, channel, i2c_regfile_dma_callback, obj_s)) {
+        return;
+    }
+    obj_s->regfile_dma = true;
+    i2c_regfile_dma_arm(obj_s);
+    I2C_CTL1(obj_s->i2c) = (I2C_CTL1(obj_s->i2c) & ~I2C_CTL1_BUFIE) | I2C_CTL1_DMAON;
+#else
+    (void)obj_s;
+#endif
+}
+
+/* end a data phase on STOP, repeated START or NACK from the master */
+static void i2c_regfile_end(struct i2c_s *obj_s)
+{
+    uint8_t phase = obj_s->regfile_phase;
+    uint16_t count;
+
+    if ((I2C_REGFILE_WRITE == phase) || (I2C_REGFILE_READ == phase)) {
+        count = i2c_regfile_moved(obj_s);
+        i2c_regfile_dma_stop(obj_s);
+        /* a byte loaded for a read the master NACKed before was never sent */
+        if ((I2C_REGFILE_READ == phase) && count && !(I2C_STAT0(obj_s->i2c) & I2C_STAT0_TBE)) {
+            count--;
+        }
+        obj_s->regfile_ptr = (obj_s->regfile_start + count) % obj_s->regfile_size;
+        if ((I2C_REGFILE_WRITE == phase) && count && (obj_s->regfile_callback != NULL)) {
+            obj_s->regfile_callback(obj_s->regfile_callback_param, obj_s->regfile_start, count);
+        }
+    }
+    obj_s->regfile_phase = I2C_REGFILE_IDLE;
+}
+
+static void i2c_regfile_phase_start(struct i2c_s *obj_s, uint8_t phase)
+{
+    obj_s->regfile_phase = phase;
+    obj_s->regfile_start = obj_s->regfile_ptr;
+    obj_s->regfile_count = 0;
+    i2c_regfile_dma_start(obj_s);
+}
+
+/** Serve slave accesses from a register file
+ *
+ * A write sets the register pointer with its first byte and stores the
+ * following bytes from there on; a read returns bytes from the pointer on.
+ * Either way the pointer increments past the bytes transferred, wrapping
+ * at the end of the file. The data phases run by DMA where the channel is
+ * free, by interrupt otherwise; user code only sees the callback, once per
+ * write, after its STOP.
+ *
+ * Call after i2c_slaves_interrupt_enable(). Replaces the slave callbacks.
+ *
+ * @param obj      The I2C object
+ * @param regs     The register file, NULL to go back to the slave callbacks
+ * @param size     Size of the register file, 1 to 256 bytes
+ * @param callback Called with (param, first register, count) after a write, or NULL
+ * @param param    Passed back to the callback
+ */
+void i2c_slave_regfile(i2c_t *obj, uint8_t *regs, uint16_t size,
+                       void (*callback)(void *, uint16_t, uint16_t), void *param)
+{
+    struct i2c_s *obj_s = I2C_S(obj);
+    uint32_t primask = __get_PRIMASK();
+
+    if (size > 256) {
+        size = 256;
+    }
+    __disable_irq();
+    i2c_regfile_dma_stop(obj_s);
+    obj_s->regfile = (0 == size) ? NULL : regs;
+    obj_s->regfile_size = size;
+    obj_s->regfile_ptr = 0;
+    obj_s->regfile_phase = I2C_REGFILE_IDLE;
+    obj_s->regfile_callback = callback;
+    obj_s->regfile_callback_param = param;
+    __set_PRIMASK(primask);
+}
+
+/** Slave side of the event interrupt, in register file mode
+ *
+ * @param obj_s The I2C object
+ */
+static void i2c_regfile_irq(struct i2c_s *obj_s)
+{
+    uint32_t i2c = obj_s->i2c;
+    uint32_t stat0 = I2C_STAT0(i2c);
+
+    /* the register number may still be pending when a repeated START comes in */
+    if (stat0 & I2C_STAT0_RBNE) {
+        uint8_t data = I2C_DATA(i2c);
+        if (I2C_REGFILE_POINTER == obj_s->regfile_phase) {
+            obj_s->regfile_ptr = data % obj_s->regfile_size;
+            i2c_regfile_phase_start(obj_s, I2C_REGFILE_WRITE);
+        } else if (I2C_REGFILE_WRITE == obj_s->regfile_phase) {
+            obj_s->regfile[(obj_s->regfile_start + obj_s->regfile_count) % obj_s->regfile_size] = data;
+            obj_s->regfile_count++;
+        }
+    } else if (stat0 & I2C_STAT0_ADDSEND) {
+        i2c_regfile_end(obj_s);
+        /* reading STAT1 clears ADDSEND */
+        if (I2C_STAT1(i2c) & I2C_STAT1_TR) {
+            i2c_regfile_phase_start(obj_s, I2C_REGFILE_READ);
+        } else {
+            obj_s->regfile_phase = I2C_REGFILE_POINTER;
+        }
+    } else if (stat0 & I2C_STAT0_TBE) {
+        if (I2C_REGFILE_READ == obj_s->regfile_phase) {
+            I2C_DATA(i2c) = obj_s->regfile[(obj_s->regfile_start + obj_s->regfile_count) %
+                                                                                     obj_s->regfile_size];
+            obj_s->regfile_count++;
+        } else {
+            I2C_DATA(i2c) = 0xFF;
+        }
+    } else if (stat0 & I2C_STAT0_STPDET) {
+        /* clear the STPDET bit */
+        i2c_enable(i2c);
+        i2c_regfile_end(obj_s);
+    }
+}
+
 /** This function handles I2C interrupt handler
  *
- * @param i2c_periph The I2C peripheral
+ * @param obj_s The I2C object
  */
 static void i2c_irq(struct i2c_s *obj_s)
 {
-    if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_ADDSEND)) {
+    uint32_t i2c;
+
+    if (obj_s == NULL) {
+        return;
+    }
+    if (I2C_XFER_IDLE != obj_s->xfer_state) {
+        i2c_master_irq(obj_s);
+        return;
+    }
+    if (obj_s->regfile != NULL) {
+        i2c_regfile_irq(obj_s);
+        return;
+    }
+    i2c = obj_s->i2c;
+    if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_ADDSEND)) {
         /* clear the ADDSEND bit */
-        i2c_interrupt_flag_clear(I2C0, I2C_INT_FLAG_ADDSEND);
+        i2c_interrupt_flag_clear(i2c, I2C_INT_FLAG_ADDSEND);
         //memset(_rx_Buffer, _rx_count, 0);
         obj_s->rx_count = 0;
-        if (i2c_flag_get(I2C0, GD32_I2C_FLAG_IS_TRANSMTR_OR_RECVR)) {
-            obj_s->slave_transmit_callback();
+        if (i2c_flag_get(i2c, GD32_I2C_FLAG_IS_TRANSMTR_OR_RECVR)) {
+            obj_s->slave_transmit_callback(obj_s->slave_callback_param);
         }
-    } else if ((i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_TBE)) &&
-               (!i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_AERR))) {
+    } else if ((i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_TBE)) &&
+               (!i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_AERR))) {
         /* Send a data byte */
         if (obj_s->tx_count > 0) {
-            i2c_data_transmit(I2C0, *obj_s->tx_buffer_ptr++);
+            i2c_data_transmit(i2c, *obj_s->tx_buffer_ptr++);
             obj_s->tx_count--;
         }
-    } else if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_RBNE)) {
+    } else if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_RBNE)) {
         /* if reception data register is not empty ,I2C1 will read a data from I2C_DATA */
-        *obj_s->rx_buffer_ptr++ = i2c_data_receive(I2C0);
-        obj_s->rx_count++;
-    } else if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_STPDET)) {
+        uint8_t data = i2c_data_receive(i2c);
+        /* drop what doesn't fit */
+        if (obj_s->rx_count < obj_s->rx_size) {
+            *obj_s->rx_buffer_ptr++ = data;
+            obj_s->rx_count++;
+        }
+    } else if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_STPDET)) {
         /* clear the STPDET bit */
-        i2c_enable(I2C0);
-        if (!i2c_flag_get(I2C0, GD32_I2C_FLAG_IS_TRANSMTR_OR_RECVR)) {
+        i2c_enable(i2c);
+        if (!i2c_flag_get(i2c, GD32_I2C_FLAG_IS_TRANSMTR_OR_RECVR)) {
             obj_s->rx_buffer_ptr = obj_s->rx_buffer_ptr - obj_s->rx_count ;
-            obj_s->slave_receive_callback(obj_s->rx_buffer_ptr, obj_s->rx_count);
+            obj_s->slave_receive_callback(obj_s->slave_callback_param, obj_s->rx_buffer_ptr,
+                                          obj_s->rx_count);
         }
     }
 }
 
-/** Handle I2C0 event interrupt request
+/** This function handles I2C error interrupt handler
  *
+ * @param obj_s The I2C object
  */
-void I2C0_EV_IRQHandler(void)
+static void i2c_error_irq(struct i2c_s *obj_s)
 {
-    i2c_irq(obj_s_buf[I2C0_INDEX]);
-}
+    uint32_t i2c;
+
+    if (obj_s == NULL) {
+        return;
+    }
+    if (I2C_XFER_IDLE != obj_s->xfer_state) {
+        i2c_master_error_irq(obj_s);
+        return;
+    }
+    i2c = obj_s->i2c;
 
-/** handle I2C0 error interrupt request
- *
- */
-void I2C0_ER_IRQHandler(void)
-{
     /* no acknowledge received */
-    if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_AERR)) {
-        i2c_interrupt_flag_clear(I2C0, I2C_INT_FLAG_AERR);
+    if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_AERR)) {
+        i2c_interrupt_flag_clear(i2c, I2C_INT_FLAG_AERR);
+        /* the master NACKs the last byte it reads */
+        if (obj_s->regfile != NULL) {
+            i2c_regfile_end(obj_s);
+        }
     }
 
     /* SMBus alert */
-    if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_SMBALT)) {
-        i2c_interrupt_flag_clear(I2C0, I2C_INT_FLAG_SMBALT);
+    if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_SMBALT)) {
+        i2c_interrupt_flag_clear(i2c, I2C_INT_FLAG_SMBALT);
     }
 
     /* bus timeout in SMBus mode */
-    if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_SMBTO)) {
-        i2c_interrupt_flag_clear(I2C0, I2C_INT_FLAG_SMBTO);
+    if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_SMBTO)) {
+        i2c_interrupt_flag_clear(i2c, I2C_INT_FLAG_SMBTO);
     }
 
     /* over-run or under-run when SCL stretch is disabled */
-    if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_OUERR)) {
-        i2c_interrupt_flag_clear(I2C0, I2C_INT_FLAG_OUERR);
+    if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_OUERR)) {
+        i2c_interrupt_flag_clear(i2c, I2C_INT_FLAG_OUERR);
     }
 
     /* arbitration lost */
-    if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_LOSTARB)) {
-        i2c_interrupt_flag_clear(I2C0, I2C_INT_FLAG_LOSTARB);
+    if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_LOSTARB)) {
+        i2c_interrupt_flag_clear(i2c, I2C_INT_FLAG_LOSTARB);
     }
 
     /* bus error */
-    if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_BERR)) {
-        i2c_interrupt_flag_clear(I2C0, I2C_INT_FLAG_BERR);
+    if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_BERR)) {
+        i2c_interrupt_flag_clear(i2c, I2C_INT_FLAG_BERR);
     }
 
     /* CRC value doesn't match */
-    if (i2c_interrupt_flag_get(I2C0, I2C_INT_FLAG_PECERR)) {
-        i2c_interrupt_flag_clear(I2C0, I2C_INT_FLAG_PECERR);
+    if (i2c_interrupt_flag_get(i2c, I2C_INT_FLAG_PECERR)) {
+        i2c_interrupt_flag_clear(i2c, I2C_INT_FLAG_PECERR);
     }
 }
+
+#ifdef I2C0
+/** Handle I2C0 event interrupt request
+ *
+ */
+void I2C0_EV_IRQHandler(void)
+{
+    i2c_irq(obj_s_buf[I2C0_INDEX]);
+}
+
+/** handle I2C0 error interrupt request
+ *
+ */
+void I2C0_ER_IRQHandler(void)
+{
+    i2c_error_irq(obj_s_buf[I2C0_INDEX]);
+}
 #endif
 
 #ifdef I2C1
@@ -710,48 +1764,212 @@ void I2C1_EV_IRQHandler(void)
  */
 void I2C1_ER_IRQHandler(void)
 {
-    /* no acknowledge received */
-    if (i2c_interrupt_flag_get(I2C1, I2C_INT_FLAG_AERR)) {
-        i2c_interrupt_flag_clear(I2C1, I2C_INT_FLAG_AERR);
-    }
+    i2c_error_irq(obj_s_buf[I2C1_INDEX]);
+}
+#endif
 
-    /* SMBus alert */
-    if (i2c_interrupt_flag_get(I2C1, I2C_INT_FLAG_SMBALT)) {
-        i2c_interrupt_flag_clear(I2C1, I2C_INT_FLAG_SMBALT);
-    }
+#if defined(GD32F30x) || defined(GD32F10x) || defined(GD32E50X)
+#define I2C_GPIO_OD    GD_PIN_FUNCTION1(PIN_MODE_OUT_OD, 0)
+#else
+#define I2C_GPIO_OD    GD_PIN_FUNCTION4(PIN_MODE_OUTPUT, PIN_OTYPE_OD, PIN_PUPD_PULLUP, 0)
+#endif
 
-    /* bus timeout in SMBus mode */
-    if (i2c_interrupt_flag_get(I2C1, I2C_INT_FLAG_SMBTO)) {
-        i2c_interrupt_flag_clear(I2C1, I2C_INT_FLAG_SMBTO);
-    }
+/** Take a consistent snapshot of the bus counters
+ *
+ * @param obj   The I2C object
+ * @param stats Where to copy the counters
+ * @param reset Non-zero to zero the counters after copying them
+ */
+void i2c_get_stats(i2c_t *obj, i2c_stats_t *stats, int reset)
+{
+    struct i2c_s *obj_s = I2C_S(obj);
+    uint32_t primask = __get_PRIMASK();
 
-    /* over-run or under-run when SCL stretch is disabled */
-    if (i2c_interrupt_flag_get(I2C1, I2C_INT_FLAG_OUERR)) {
-        i2c_interrupt_flag_clear(I2C1, I2C_INT_FLAG_OUERR);
+    __disable_irq();
+    *stats = obj_s->stats;
+    if (reset) {
+        memset(&obj_s->stats, 0, sizeof(obj_s->stats));
     }
+    __set_PRIMASK(primask);
+    stats->time_avg_us = stats->transactions ? (uint32_t)(stats->time_total_us / stats->transactions) : 0;
+}
 
-    /* arbitration lost */
-    if (i2c_interrupt_flag_get(I2C1, I2C_INT_FLAG_LOSTARB)) {
-        i2c_interrupt_flag_clear(I2C1, I2C_INT_FLAG_LOSTARB);
+/** Free a bus held by a slave, then reset the peripheral
+ *
+ * A slave that was interrupted mid-byte can hold SDA low until it has
+ * clocked out the rest of it. With SDA and SCL driven as GPIOs, clock SCL up
+ * to nine times until SDA is released, send a STOP, then reinitialize the
+ * peripheral with its own address, SCL rate and slave interrupts. Takes at
+ * most about ten SCL periods, plus WIRE_I2C_ACK_TIMEOUT per pulse that a
+ * slave stretches.
+ *
+ * @param obj The I2C object
+ * @return I2C_OK if both lines ended up high, I2C_BUSY otherwise
+ */
+i2c_status_enum i2c_bus_recover(i2c_t *obj)
+{
+    struct i2c_s *obj_s = I2C_S(obj);
+    uint8_t own_address = I2C_SADDR0(obj_s->i2c) & 0xFEU;
+    bool slave = obj_s->slave_irq;
+    uint32_t scl_hz = obj_s->scl_hz ? obj_s->scl_hz : I2C_CLOCK_SM;
+    uint32_t ckcfg = I2C_CKCFG(obj_s->i2c);
+    uint32_t rt = I2C_RT(obj_s->i2c);
+#ifdef I2C_FMPCFG_FMPEN
+    uint32_t fmpcfg = I2C_FMPCFG(obj_s->i2c);
+#endif
+    uint32_t half = (500000U + scl_hz - 1) / scl_hz;
+    uint32_t sda_port = gpio_clock_enable(GD_PORT_GET(obj_s->sda));
+    uint32_t scl_port = gpio_clock_enable(GD_PORT_GET(obj_s->scl));
+    uint32_t sda_pin = 1U << GD_PIN_GET(obj_s->sda);
+    uint32_t scl_pin = 1U << GD_PIN_GET(obj_s->scl);
+    i2c_deadline_t deadline;
+    i2c_status_enum ret;
+    int i;
+
+    if (I2C_XFER_IDLE != obj_s->xfer_state) {
+        i2c_master_abort(obj, I2C_BUSY);
+    }
+    obj_s->stats.busy_resets++;
+    i2c_disable(obj_s->i2c);
+    gpio_bit_set(sda_port, sda_pin);
+    gpio_bit_set(scl_port, scl_pin);
+    pin_function(obj_s->sda, I2C_GPIO_OD);
+    pin_function(obj_s->scl, I2C_GPIO_OD);
+    i2c_delay_us(half);
+
+    for (i = 0; (i < 9) && (RESET == gpio_input_bit_get(sda_port, sda_pin)); i++) {
+        gpio_bit_reset(scl_port, scl_pin);
+        i2c_delay_us(half);
+        gpio_bit_set(scl_port, scl_pin);
+        /* the slave may stretch the clock */
+        i2c_deadline_start(&deadline, WIRE_I2C_ACK_TIMEOUT);
+        while ((RESET == gpio_input_bit_get(scl_port, scl_pin)) && !i2c_deadline_expired(&deadline)) {
+        }
+        i2c_delay_us(half);
     }
 
-    /* bus error */
-    if (i2c_interrupt_flag_get(I2C1, I2C_INT_FLAG_BERR)) {
-        i2c_interrupt_flag_clear(I2C1, I2C_INT_FLAG_BERR);
+    /* STOP: SDA rises while SCL is high */
+    gpio_bit_reset(scl_port, scl_pin);
+    i2c_delay_us(half);
+    gpio_bit_reset(sda_port, sda_pin);
+    i2c_delay_us(half);
+    gpio_bit_set(scl_port, scl_pin);
+    i2c_delay_us(half);
+    gpio_bit_set(sda_port, sda_pin);
+    i2c_delay_us(half);
+
+    if ((SET == gpio_input_bit_get(sda_port, sda_pin)) &&
+        (SET == gpio_input_bit_get(scl_port, scl_pin))) {
+        ret = I2C_OK;
+    } else {
+        ret = I2C_BUSY;
     }
 
-    /* CRC value doesn't match */
-    if (i2c_interrupt_flag_get(I2C1, I2C_INT_FLAG_PECERR)) {
-        i2c_interrupt_flag_clear(I2C1, I2C_INT_FLAG_PECERR);
+    i2c_deinit(obj_s->i2c);
+    i2c_init(obj, obj_s->sda, obj_s->scl, own_address);
+    /* restore the timing i2c_set_clock() had computed */
+    i2c_disable(obj_s->i2c);
+    I2C_CKCFG(obj_s->i2c) = ckcfg;
+    I2C_RT(obj_s->i2c) = rt;
+#ifdef I2C_FMPCFG_FMPEN
+    I2C_FMPCFG(obj_s->i2c) = fmpcfg;
+#endif
+    obj_s->scl_hz = scl_hz;
+    i2c_enable(obj_s->i2c);
+    if (slave) {
+        i2c_slaves_interrupt_enable(obj);
     }
+    return ret;
 }
 
-void i2c_set_clock(i2c_t *obj, uint32_t clock_hz)
+/** Set the SCL rate, from a divider computed against the APB1 clock
+ *
+ * Picks the mode, duty cycle and divider giving the highest SCL rate at or
+ * below the request; rates above 400 kHz use Fast-mode Plus where the part
+ * has it, and are capped at 400 kHz otherwise. The peripheral must be
+ * disabled.
+ *
+ * @param obj      The I2C object
+ * @param clock_hz The requested SCL rate
+ * @return The SCL rate actually configured, ignoring rise times
+ */
+uint32_t i2c_set_clock(i2c_t *obj, uint32_t clock_hz)
 {
-    i2c_clock_config(obj->i2c, clock_hz, I2C_DTCY_2);
-}
+    uint32_t pclk1 = rcu_clock_freq_get(CK_APB1);
+    uint32_t freq = pclk1 / 1000000U;
+    uint32_t ckcfg, clkc, rt, actual;
 
+#ifdef I2C_FMPCFG_FMPEN
+    if (clock_hz > I2C_CLOCK_FMP) {
+        clock_hz = I2C_CLOCK_FMP;
+    }
+#else
+    if (clock_hz > I2C_CLOCK_FM) {
+        clock_hz = I2C_CLOCK_FM;
+    }
 #endif
+    if (0 == clock_hz) {
+        clock_hz = I2C_CLOCK_SM;
+    }
+    if (freq > I2C_CTL1_I2CCLK) {
+        freq = I2C_CTL1_I2CCLK;
+    }
+    I2C_CTL1(obj->i2c) = (I2C_CTL1(obj->i2c) & ~I2C_CTL1_I2CCLK) | freq;
+
+    if (clock_hz <= I2C_CLOCK_SM) {
+        /* SCL high and low both last CLKC periods, CLKC >= 4 */
+        clkc = (pclk1 + 2 * clock_hz - 1) / (2 * clock_hz);
+        if (clkc < 4) {
+            clkc = 4;
+        }
+        if (clkc > I2C_CKCFG_CLKC) {
+            clkc = I2C_CKCFG_CLKC;
+        }
+        ckcfg = clkc;
+        actual = pclk1 / (2 * clkc);
+        /* 1000 ns maximum rise time */
+        rt = freq + 1;
+    } else {
+        /* duty cycle 2: period of 3 CLKC; duty cycle 16/9: period of 25 CLKC */
+        uint32_t clkc2 = (pclk1 + 3 * clock_hz - 1) / (3 * clock_hz);
+        uint32_t clkc169 = (pclk1 + 25 * clock_hz - 1) / (25 * clock_hz);
+
+        if (0 == clkc2) {
+            clkc2 = 1;
+        }
+        if (0 == clkc169) {
+            clkc169 = 1;
+        }
+        if (clkc2 > I2C_CKCFG_CLKC) {
+            clkc2 = I2C_CKCFG_CLKC;
+        }
+        if (clkc169 > I2C_CKCFG_CLKC) {
+            clkc169 = I2C_CKCFG_CLKC;
+        }
+        if (pclk1 / (25 * clkc169) > pclk1 / (3 * clkc2)) {
+            clkc = clkc169;
+            ckcfg = I2C_CKCFG_FAST | I2C_CKCFG_DTCY | clkc;
+            actual = pclk1 / (25 * clkc);
+        } else {
+            clkc = clkc2;
+            ckcfg = I2C_CKCFG_FAST | clkc;
+            actual = pclk1 / (3 * clkc);
+        }
+        /* 300 ns maximum rise time in Fast mode, 120 ns in Fast-mode Plus */
+        rt = (freq * ((clock_hz > I2C_CLOCK_FM) ? 120U : 300U)) / 1000U + 1;
+    }
+    if (rt < 2) {
+        rt = 2;
+    }
+    I2C_CKCFG(obj->i2c) = ckcfg;
+    I2C_RT(obj->i2c) = rt;
+#ifdef I2C_FMPCFG_FMPEN
+    I2C_FMPCFG(obj->i2c) = (clock_hz > I2C_CLOCK_FM) ? I2C_FMPCFG_FMPEN : 0;
+#endif
+    obj->scl_hz = actual;
+    return actual;
+}
+
 #ifdef __cplusplus
 }
 #endif
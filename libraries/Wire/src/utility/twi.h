@@ -33,18 +33,84 @@ OF SUCH DAMAGE.
 #include "gd32_def.h"
 #include "PeripheralPins.h"
 #include "gd32xxyy.h"
+#include <stdbool.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* I2C Tx/Rx buffer size */
+/* default I2C Tx/Rx buffer size, rounded down to a power of two */
 #if !defined(I2C_BUFFER_SIZE)
 #define I2C_BUFFER_SIZE    32
-#elif (I2C_BUFFER_SIZE >= 256)
-#error I2C buffer size cannot exceed 255
 #endif
 
+/* SCL rates of the Standard, Fast and Fast-mode Plus bus modes */
+#define I2C_CLOCK_SM       100000U
+#define I2C_CLOCK_FM       400000U
+#define I2C_CLOCK_FMP      1000000U
+
+typedef enum {
+    /* transfer status */
+    I2C_OK            = 0,
+    I2C_DATA_TOO_LONG = 1,
+    I2C_NACK_ADDR     = 2,
+    I2C_NACK_DATA     = 3,
+    I2C_ERROR         = 4,
+    I2C_TIMEOUT       = 5,
+    I2C_BUSY          = 6
+} i2c_status_enum;
+
+/* interrupt-driven master transfer phases */
+typedef enum {
+    I2C_XFER_IDLE = 0,
+    I2C_XFER_START,         /* waiting for SBSEND */
+    I2C_XFER_ADDR,          /* waiting for ADDSEND */
+    I2C_XFER_TX,
+    I2C_XFER_RX
+} i2c_xfer_state_enum;
+
+/* phases of a slave register file access */
+typedef enum {
+    I2C_REGFILE_IDLE = 0,
+    I2C_REGFILE_POINTER,    /* addressed for a write, register number next */
+    I2C_REGFILE_WRITE,
+    I2C_REGFILE_READ
+} i2c_regfile_phase_enum;
+
+/* queued transaction types */
+typedef enum {
+    I2C_OP_WRITE = 0,
+    I2C_OP_READ,
+    I2C_OP_WRITE_READ       /* write, repeated START, read */
+} i2c_op_type_enum;
+
+/* one transaction of a queue passed to i2c_master_queue() */
+typedef struct {
+    uint8_t    type;
+    uint8_t    address;     /* 7-bit */
+    uint8_t    *tx;
+    uint16_t   tx_length;
+    uint8_t    *rx;
+    uint16_t   rx_length;
+    volatile i2c_status_enum status;
+} i2c_op_t;
+
+/* Per-bus counters of master transfers, updated from interrupt context */
+typedef struct {
+    uint32_t transactions;      /* transfers started, whatever their outcome */
+    uint32_t bytes;             /* data bytes transferred */
+    uint32_t nack_addr;         /* no ACK to the address */
+    uint32_t nack_data;         /* no ACK to a data byte */
+    uint32_t timeouts;
+    uint32_t arbitration_lost;  /* LOSTARB: another controller won the bus */
+    uint32_t bus_errors;        /* BERR: misplaced START or STOP */
+    uint32_t busy_resets;       /* bus recoveries, see i2c_bus_recover() */
+    uint32_t time_min_us;       /* shortest transfer */
+    uint32_t time_max_us;       /* longest transfer */
+    uint32_t time_avg_us;       /* filled in by i2c_get_stats() */
+    uint64_t time_total_us;
+} i2c_stats_t;
+
 typedef struct i2c_s i2c_t;
 
 struct i2c_s {
@@ -53,27 +119,62 @@ struct i2c_s {
     uint8_t index;
     PinName sda;
     PinName scl;
+    uint32_t scl_hz;
     /* operating parameters */
     uint8_t    *tx_buffer_ptr;
     uint8_t    *rx_buffer_ptr;
     uint16_t   tx_count;
     uint16_t   rx_count;
-
-    void (*slave_transmit_callback)(void);
-    void (*slave_receive_callback)(uint8_t *, int);
+    /* room behind tx_buffer_ptr and rx_buffer_ptr */
+    uint16_t   tx_size;
+    uint16_t   rx_size;
+
+    void (*slave_transmit_callback)(void *);
+    void (*slave_receive_callback)(void *, uint8_t *, int);
+    void *slave_callback_param;
+    bool slave_irq;
+
+    /* interrupt-driven master transfer */
+    volatile uint8_t xfer_state;
+    volatile i2c_status_enum xfer_status;
+    uint8_t    xfer_address;
+    uint32_t   xfer_direction;
+    uint8_t    xfer_stop;
+    uint8_t    *xfer_ptr;
+    uint16_t   xfer_length;
+    uint16_t   xfer_count;
+    bool       xfer_dma;
+    /* run by a blocking call, which doesn't report to master_callback */
+    bool       xfer_blocking;
+    /* a polled master transfer has the peripheral, see i2c_master_claim() */
+    volatile bool polled;
+    uint32_t   xfer_start_us;
+    void (*master_callback)(void *, i2c_status_enum);
+    void *master_callback_param;
+
+    /* transaction queue */
+    i2c_op_t   *queue_ops;
+    uint16_t   queue_count;
+    uint16_t   queue_index;
+    uint8_t    queue_phase;
+    void (*queue_callback)(void *);
+    void *queue_callback_param;
+
+    /* slave register file */
+    uint8_t    *regfile;
+    uint16_t   regfile_size;
+    volatile uint16_t regfile_ptr;
+    uint16_t   regfile_start;
+    uint16_t   regfile_count;
+    uint16_t   regfile_dma_length;
+    volatile uint8_t regfile_phase;
+    bool       regfile_dma;
+    void (*regfile_callback)(void *, uint16_t, uint16_t);
+    void *regfile_callback_param;
+
+    i2c_stats_t stats;
 };
 
-typedef enum {
-    /* transfer status */
-    I2C_OK            = 0,
-    I2C_DATA_TOO_LONG = 1,
-    I2C_NACK_ADDR     = 2,
-    I2C_NACK_DATA     = 3,
-    I2C_ERROR         = 4,
-    I2C_TIMEOUT       = 5,
-    I2C_BUSY          = 6
-} i2c_status_enum;
-
 /* Initialize the I2C peripheral */
 void i2c_init(i2c_t *obj, PinName sda, PinName scl, uint8_t address);
 /* Enable the I2C interrupt */
@@ -87,13 +188,38 @@ i2c_status_enum i2c_master_receive(i2c_t *obj, uint8_t address, uint8_t *data, u
 /* read bytes in master mode at a given address */
 i2c_status_enum i2c_wait_standby_state(i2c_t *obj, uint8_t address);
 /* sets function called before a slave read operation */
-void i2c_attach_slave_rx_callback(i2c_t *obj, void (*function)(uint8_t *, int));
+void i2c_attach_slave_rx_callback(i2c_t *obj, void (*function)(void *, uint8_t *, int), void *param);
 /* sets function called before a slave write operation */
-void i2c_attach_slave_tx_callback(i2c_t *obj, void (*function)(void));
+void i2c_attach_slave_tx_callback(i2c_t *obj, void (*function)(void *), void *param);
+/* Serve slave accesses from a register file */
+void i2c_slave_regfile(i2c_t *obj, uint8_t *regs, uint16_t size,
+                       void (*callback)(void *, uint16_t, uint16_t), void *param);
 /* Write bytes to master */
 i2c_status_enum i2c_slave_write_buffer(i2c_t *obj, uint8_t *data, uint16_t size);
+/* Take a snapshot of the bus counters */
+void i2c_get_stats(i2c_t *obj, i2c_stats_t *stats, int reset);
+/* Clock a stuck bus free, send STOP and reset the peripheral */
+i2c_status_enum i2c_bus_recover(i2c_t *obj);
 /* set I2C clock speed */
-void i2c_set_clock(i2c_t *obj, uint32_t clock_hz);
+uint32_t i2c_set_clock(i2c_t *obj, uint32_t clock_hz);
+/* Start an interrupt-driven write */
+i2c_status_enum i2c_master_transmit_it(i2c_t *obj, uint8_t address, uint8_t *data, uint16_t length,
+                                       uint8_t stop);
+/* Start an interrupt-driven read */
+i2c_status_enum i2c_master_receive_it(i2c_t *obj, uint8_t address, uint8_t *data, uint16_t length,
+                                      uint8_t stop);
+/* Whether an interrupt-driven transfer is still running */
+bool i2c_master_busy(i2c_t *obj);
+/* Result of the last interrupt-driven transfer */
+i2c_status_enum i2c_master_status(i2c_t *obj);
+/* Give up on a running interrupt-driven transfer */
+void i2c_master_abort(i2c_t *obj, i2c_status_enum status);
+/* Run a list of transactions back to back from the I2C interrupt */
+i2c_status_enum i2c_master_queue(i2c_t *obj, i2c_op_t *ops, uint16_t count,
+                                 void (*callback)(void *), void *param);
+/* sets function called from the I2C interrupt when a transfer ends */
+void i2c_attach_master_callback(i2c_t *obj, void (*function)(void *, i2c_status_enum),
+                                void *param);
 
 
 